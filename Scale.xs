@@ -6,6 +6,7 @@
 // so we have to load png.h first
 #ifdef HAVE_PNG
 #include <png.h>
+#include <zlib.h> // strategy constants for png_set_compression_strategy
 #endif
 
 #include "EXTERN.h"
@@ -92,109 +93,60 @@ CODE:
 {
   image *im = (image *)SvPVX(SvRV(*(my_hv_fetch(self, "_image"))));
 
-  // Reset options if resize is being called multiple times
-  if (im->target_width) {
-    im->target_width  = 0;
-    im->target_height = 0;
-    im->keep_aspect   = 0;
-    im->orientation   = im->orientation_orig;
-    im->bgcolor       = 0;
-    im->memory_limit  = 0;
-    im->resize_type   = IMAGE_SCALE_TYPE_GD;
-    im->filter        = 0;
-  }
+  image_resize_options(im, opts);
 
-  if (my_hv_exists(opts, "width"))
-    im->target_width = SvIV(*(my_hv_fetch(opts, "width")));
+  RETVAL = image_resize(im);
+}
+OUTPUT:
+  RETVAL
 
-  if (my_hv_exists(opts, "height"))
-    im->target_height = SvIV(*(my_hv_fetch(opts, "height")));
+void
+__init_resized(HV *self)
+PPCODE:
+{
+  image *im = (image *)SvPVX(SvRV(*(my_hv_fetch(self, "_image"))));
+  SV *pv = NEWSV(0, sizeof(image));
+  image *out = (image *)SvPVX(pv);
 
-  if (!im->target_width && !im->target_height) {
-    croak("Image::Scale->resize requires at least one of height or width");
-  }
+  SvPOK_only(pv);
 
-  if (my_hv_exists(opts, "keep_aspect"))
-    im->keep_aspect = SvIV(*(my_hv_fetch(opts, "keep_aspect")));
+  image_init_resized(im, out);
 
-  if (my_hv_exists(opts, "ignore_exif")) {
-    if (SvIV(*(my_hv_fetch(opts, "ignore_exif"))) != 0)
-      im->orientation = ORIENTATION_NORMAL;
-  }
+  XPUSHs( sv_2mortal( sv_bless(
+    newRV_noinc(pv),
+    gv_stashpv("Image::Scale::XS", 1)
+  ) ) );
+}
 
-  if (my_hv_exists(opts, "bgcolor"))
-    im->bgcolor = SvIV(*(my_hv_fetch(opts, "bgcolor"))) << 8 | 0xFF;
-
-  if (my_hv_exists(opts, "memory_limit"))
-    im->memory_limit = SvIV(*(my_hv_fetch(opts, "memory_limit")));
-
-  if (my_hv_exists(opts, "type"))
-    im->resize_type = SvIV(*(my_hv_fetch(opts, "type")));
-
-  if (my_hv_exists(opts, "filter")) {
-    char *filterstr = SvPVX(*(my_hv_fetch(opts, "filter")));
-    if (strEQ("Point", filterstr))
-      im->filter = PointFilter;
-    else if (strEQ("Box", filterstr))
-      im->filter = BoxFilter;
-    else if (strEQ("Triangle", filterstr))
-      im->filter = TriangleFilter;
-    else if (strEQ("Hermite", filterstr))
-      im->filter = HermiteFilter;
-    else if (strEQ("Hanning", filterstr))
-      im->filter = HanningFilter;
-    else if (strEQ("Hamming", filterstr))
-      im->filter = HammingFilter;
-    else if (strEQ("Blackman", filterstr))
-      im->filter = BlackmanFilter;
-    else if (strEQ("Gaussian", filterstr))
-      im->filter = GaussianFilter;
-    else if (strEQ("Quadratic", filterstr))
-      im->filter = QuadraticFilter;
-    else if (strEQ("Cubic", filterstr))
-      im->filter = CubicFilter;
-    else if (strEQ("Catrom", filterstr))
-      im->filter = CatromFilter;
-    else if (strEQ("Mitchell", filterstr))
-      im->filter = MitchellFilter;
-    else if (strEQ("Lanczos", filterstr))
-      im->filter = LanczosFilter;
-    else if (strEQ("Bessel", filterstr))
-      im->filter = BesselFilter;
-    else if (strEQ("Sinc", filterstr))
-      im->filter = SincFilter;
-  }
+int
+__resize_multi(HV *self, AV *specs, AV *images)
+CODE:
+{
+  image *im = (image *)SvPVX(SvRV(*(my_hv_fetch(self, "_image"))));
+  image **outs;
+  int count = av_len(specs) + 1;
+  int i;
 
-  // If the image will be rotated 90 degrees, swap the target values
-  if (im->orientation >= 5) {
-    if (!im->target_height) {
-      // Only width was specified, but this will actually be the target height
-      im->target_height = im->target_width;
-      im->target_width = 0;
-    }
-    else if (!im->target_width) {
-      // Only height was specified, but this will actually be the target width
-      im->target_width = im->target_height;
-      im->target_height = 0;
-    }
-  }
+  if (count < 1)
+    croak("Image::Scale->resize_multi requires at least one size");
 
-  if (!im->target_height) {
-    // Only width was specified
-    im->target_height = (int)((float)im->height / im->width * im->target_width);
-    if (im->target_height < 1)
-      im->target_height = 1;
-  }
-  else if (!im->target_width) {
-    // Only height was specified
-    im->target_width = (int)((float)im->width / im->height * im->target_height);
-    if (im->target_width < 1)
-      im->target_width = 1;
-  }
+  if (av_len(images) + 1 != count)
+    croak("Image::Scale->resize_multi needs one image per size");
 
-  DEBUG_TRACE("Resizing from %d x %d -> %d x %d\n", im->width, im->height, im->target_width, im->target_height);
+  New(0, outs, count, image *);
+  SAVEFREEPV(outs);
 
-  RETVAL = image_resize(im);
+  for (i = 0; i < count; i++) {
+    SV *spec = *(av_fetch(specs, i, 0));
+
+    if ( !SvROK(spec) || SvTYPE(SvRV(spec)) != SVt_PVHV )
+      croak("Image::Scale->resize_multi sizes must be hashrefs");
+
+    outs[i] = (image *)SvPVX(SvRV(*(av_fetch(images, i, 0))));
+    image_resize_options(outs[i], (HV *)SvRV(spec));
+  }
+
+  RETVAL = image_resize_multi(im, outs, count);
 }
 OUTPUT:
   RETVAL
@@ -237,23 +189,41 @@ OUTPUT:
 
 #ifdef HAVE_PNG
 void
-save_png(HV *self, SV *path)
+save_png(HV *self, SV *path, ...)
 CODE:
 {
   image *im = (image *)SvPVX(SvRV(*(my_hv_fetch(self, "_image"))));
+  image_png_options o;
+
+  image_png_options_init(&o, NULL);
+
+  if (items == 3 && SvOK(ST(2))) {
+    if ( !SvROK(ST(2)) || SvTYPE(SvRV(ST(2))) != SVt_PVHV )
+      croak("Image::Scale->save_png options must be a hashref");
+    image_png_options_init(&o, (HV *)SvRV(ST(2)));
+  }
 
-  image_png_save(im, SvPV_nolen(path));
+  image_png_save(im, SvPV_nolen(path), &o);
 }
 
 SV *
-as_png(HV *self)
+as_png(HV *self, ...)
 CODE:
 {
   image *im = (image *)SvPVX(SvRV(*(my_hv_fetch(self, "_image"))));
+  image_png_options o;
+
+  image_png_options_init(&o, NULL);
+
+  if (items == 2 && SvOK(ST(1))) {
+    if ( !SvROK(ST(1)) || SvTYPE(SvRV(ST(1))) != SVt_PVHV )
+      croak("Image::Scale->as_png options must be a hashref");
+    image_png_options_init(&o, (HV *)SvRV(ST(1)));
+  }
 
   RETVAL = newSVpvn("", 0);
 
-  image_png_to_sv(im, RETVAL);
+  image_png_to_sv(im, RETVAL, &o);
 }
 OUTPUT:
   RETVAL
@@ -267,6 +237,38 @@ CODE:
   image_finish(im);
 }
 
+SV *
+__probe(SV *src, HV *opts)
+CODE:
+{
+  image_probe_src ps;
+
+  RETVAL = image_probe(src, opts, &ps);
+}
+OUTPUT:
+  RETVAL
+
+SV *
+__probe_many(AV *files)
+CODE:
+{
+  // One read buffer for every file
+  image_probe_src ps;
+  AV *results = newAV();
+  int i;
+
+  av_extend(results, av_len(files));
+
+  for (i = 0; i <= av_len(files); i++) {
+    SV **file = av_fetch(files, i, 0);
+    av_push( results, file != NULL ? image_probe(*file, NULL, &ps) : newSV(0) );
+  }
+
+  RETVAL = newRV_noinc((SV *)results);
+}
+OUTPUT:
+  RETVAL
+
 SV *
 jpeg_version(void)
 CODE:
@@ -306,3 +308,22 @@ CODE:
 OUTPUT:
   RETVAL
 
+
+SV *
+simd(...)
+CODE:
+{
+  if (items > 1) {
+    char *name = SvPV_nolen(ST(1));
+
+    if (simd == NULL)
+      image_simd_init();
+
+    if ( !image_simd_set(name) )
+      croak("Image::Scale unknown SIMD kernel set: %s\n", name);
+  }
+
+  RETVAL = newSVpv( image_simd_name(), 0 );
+}
+OUTPUT:
+  RETVAL
@@ -16,10 +16,22 @@
 
 #ifdef HAVE_JPEG
 #include <jpeglib.h>
+#include <jerror.h>
 #endif
 #ifdef HAVE_GIF
 #include <gif_lib.h>
 #endif
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+// SSE4.1 and AVX2/FMA kernels are compiled using the target attribute, see simd.c
+#if (defined(__x86_64__) || defined(__i386__)) \
+  && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define HAVE_SIMD
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2  __attribute__((target("avx2,fma")))
+#include <immintrin.h>
+#endif
 
 #define BUFFER_SIZE 4096
 
@@ -60,6 +72,7 @@ static inline int lrintf(float f) {
 #endif
 
 #define ROUND_FLOAT_TO_INT(x) lrintf(x)
+#define ROUND_FLOAT_TO_COL(x) ((int)((x) < 0.0 ? 0 : ((x) > 255.0) ? 255 : ROUND_FLOAT_TO_INT(x)))
 
 #define EPSILON 1.0e-12
 #define PI      3.14159265358979323846264338327950288419716939937510
@@ -88,6 +101,9 @@ enum resize_type {
   IMAGE_SCALE_TYPE_GM_FIXED
 };
 
+// resize_multi() makes a size from an earlier, larger result when it is at least this many times larger
+#define IMAGE_MULTI_MIN_SCALE 2
+
 // Exif Orientation
 enum orientation {
   ORIENTATION_NORMAL = 1,
@@ -114,17 +130,28 @@ typedef struct {
   int colors[256];
 } palette;
 
+// PNG encoder settings, see image_png_options_init().  -1 leaves the libpng default
+typedef struct {
+  int level;    // zlib compression level
+  int filters;  // mask of PNG_FILTER_* row filters to choose from
+  int strategy; // zlib strategy
+} image_png_options;
+
 typedef struct {
   Buffer  *buf;
   SV      *path;
   PerlIO  *fh;
   SV      *sv_data;
+  unsigned char *map; // the file when it is memory-mapped, read the same way as sv_data
+  size_t  map_len;
   int32_t sv_offset;
   int32_t image_offset;
   int32_t image_length;
   int32_t type;
   int32_t width;
   int32_t height;
+  int32_t width_orig;     // size from the header, width/height are the size it was decoded at
+  int32_t height_orig;
   int32_t width_padding;  // empty padding pixels to leave to maintain aspect
   int32_t width_inner;    // width of inner area when maintaining aspect
   int32_t height_padding;
@@ -144,18 +171,37 @@ typedef struct {
   pix     *tmpbuf; // Temporary intermediate image
   palette *palette;
 
+  // Streaming resize, see stream.c
+  int32_t can_stream; // set while loading if the resize may run during decoding
+  int32_t ring_rows;  // if not 0, pixbuf only holds this many source rows
+  struct image_stream *stream;
+  int32_t outbuf_rows; // if not 0, outbuf only holds this many rows of the resized image
+  struct image_writer *writer;
+
   // Resize options
   int32_t memory_limit;
   int32_t target_width;
   int32_t target_height;
   int32_t keep_aspect;
+  int32_t snap;         // JPEG only, see image_jpeg_load()
+  int32_t use_exif_thumbnail; // JPEG only, see image_jpeg_use_thumbnail()
   int32_t resize_type;
   int32_t filter;
   int32_t bgcolor;
+  int32_t threads;
+  int32_t save_type;    // JPEG or PNG to encode as part of the resize, see writer.c
+  int32_t save_quality;
+  image_png_options save_png_options;
+  SV      *save_dest;   // path or scalar ref to save to
 
 #ifdef HAVE_JPEG
   struct jpeg_decompress_struct *cinfo;
   struct jpeg_error_mgr *jpeg_error_pub;
+  int32_t jpeg_coef_size; // libjpeg's whole-image coefficient buffer, counted in memory_used
+  int32_t exif_thumb_offset; // position of the EXIF thumbnail JPEG in the APP1 marker data
+  int32_t exif_thumb_length; // 0 if there is no usable thumbnail
+  int32_t exif_thumb_width;
+  int32_t exif_thumb_height;
 #endif
 
 #ifdef HAVE_PNG
@@ -174,9 +220,32 @@ get_pix(image *im, int32_t x, int32_t y)
 	return (im->pixbuf[(y * im->width) + x]);
 }
 
+// Source row y, which is in the ring of rows while streaming
+static inline pix *
+image_row(image *im, int32_t y)
+{
+  if (im->ring_rows)
+    y %= im->ring_rows;
+
+  return &im->pixbuf[y * im->width];
+}
+
+// Row y of the resized image, outbuf may only hold a band of rows while streaming
+static inline pix *
+image_out_row(image *im, int32_t y)
+{
+  if (im->outbuf_rows)
+    y %= im->outbuf_rows;
+
+  return &im->outbuf[y * im->target_width];
+}
+
 static inline void
 put_pix(image *im, int32_t x, int32_t y, pix col)
 {
+  if (im->outbuf_rows)
+    y %= im->outbuf_rows;
+
 	im->outbuf[(y * im->target_width) + x] = col;
 }
 
@@ -187,12 +256,21 @@ put_pix_rotated(image *im, int32_t x, int32_t y, int32_t rotated_width, pix col)
 }
 
 int image_init(HV *self, image *im);
+void image_resize_options(image *im, HV *opts);
 int image_resize(image *im);
+void image_init_resized(image *im, image *out);
+int image_resize_multi(image *im, image **outs, int count);
 void image_downsize_gd(image *im);
 void image_downsize_gd_fixed_point(image *im);
 void image_downsize_gm(image *im);
 void image_alloc(image *im, int width, int height);
+int image_outbuf_alloc(image *im);
+void image_outbuf_rotated(image *im);
+void image_outbuf_free(image *im);
 void image_bgcolor_fill(pix *buf, int size, int bgcolor);
+int image_pix_opaque(pix *p, int count);
+int image_gray_source(image *im);
+int image_gray_output(image *im);
 void image_finish(image *im);
 inline void image_get_rotated_coords(image *im, int x, int y, int *ox, int *oy);
 
@@ -217,7 +295,8 @@ void image_gif_finish(image *im);
 #ifdef HAVE_PNG
 int image_png_read_header(image *im);
 int image_png_load(image *im);
-void image_png_save(image *im, const char *path);
-void image_png_to_sv(image *im, SV *sv_buf);
+void image_png_options_init(image_png_options *o, HV *opts);
+void image_png_save(image *im, const char *path, image_png_options *o);
+void image_png_to_sv(image *im, SV *sv_buf, image_png_options *o);
 void image_png_finish(image *im);
 #endif
@@ -39,8 +39,32 @@ typedef struct _ContributionInfoFixed {
   int pixel;
 } ContributionInfoFixed;
 
+typedef struct _ContributionTable {
+  int max_n;                 // contributions allocated per destination pixel
+  int *counts;               // number of contributions used by each destination pixel
+  ContributionInfo *weights; // max_n contributions for each destination pixel
+  float *normalize;          // 1 / sum of the weights for each destination pixel
+} ContributionTable;
+
+typedef struct _ContributionTableFixed {
+  int max_n;                      // contributions allocated per destination pixel
+  int *counts;                    // number of contributions used by each destination pixel
+  ContributionInfoFixed *weights; // max_n contributions for each destination pixel
+  fixed_t *normalize;             // 1 / sum of the weights for each destination pixel
+  int overflow;                   // weights are too large for 32-bit accumulators
+} ContributionTableFixed;
+
 typedef struct _ImageInfo {
   int32_t rows;
   int32_t columns;
   pix *buf;
 } ImageInfo;
+
+// One pass of a filter, split across the worker pool by destination row
+typedef struct _FilterPass {
+  ImageInfo *source;
+  ImageInfo *destination;
+  const ContributionTable *table;
+  const ContributionTableFixed *table_fixed;
+  int rotate;
+} FilterPass;
@@ -0,0 +1,31 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+// Upper limit for the threads resize option
+#define IMAGE_POOL_MAX_THREADS 64
+
+// A job covers rows 0 - len, and is split into parts of contiguous rows that
+// run in parallel.  Jobs run on worker threads so must not call any Perl API
+// functions, including New/Safefree and warn/croak.
+typedef void (*image_pool_job)(image *im, void *arg, int part, int start, int end);
+
+int image_pool_parts(image *im, int len);
+void image_pool_run(image *im, int len, image_pool_job job, void *arg);
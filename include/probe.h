@@ -0,0 +1,39 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define PROBE_BUFFER_SIZE 4096
+
+// A file or scalar being probed, file data is read on demand into buf.
+// Positions are relative to the offset option
+typedef struct {
+  int fd;               // -1 when probing a scalar
+  unsigned char *data;  // scalar data
+  int32_t offset;
+  int32_t length;       // bytes available after offset, -1 if unknown
+  int32_t buf_pos;      // position of buf[0]
+  int32_t buf_len;
+  unsigned char buf[PROBE_BUFFER_SIZE];
+} image_probe_src;
+
+typedef struct {
+  int type;
+  int width;
+  int height;
+  int channels;
+  int orientation;
+} image_probe_info;
+
+SV *image_probe(SV *src, HV *opts, image_probe_src *ps);
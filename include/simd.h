@@ -0,0 +1,48 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Resize kernels that have CPU-specific variants, one set is selected at runtime
+typedef struct {
+  const char *name;
+
+  // Pool job for rows of a resize_gd_fixed_point, see image_downsize_gd_fixed_point()
+  image_pool_job gd_fixed_point_rows;
+
+  // The GM filters produce rows start - end of the destination
+  void (*gm_horizontal_filter)(image *im, ImageInfo *source, ImageInfo *destination,
+    const ContributionTable *table, int rotate, int start, int end);
+  void (*gm_vertical_filter)(image *im, ImageInfo *source, ImageInfo *destination,
+    const ContributionTable *table, int rotate, int start, int end);
+
+  void (*gm_horizontal_filter_fixed_point)(image *im, ImageInfo *source, ImageInfo *destination,
+    const ContributionTableFixed *table, int rotate, int start, int end);
+  void (*gm_vertical_filter_fixed_point)(image *im, ImageInfo *source, ImageInfo *destination,
+    const ContributionTableFixed *table, int rotate, int start, int end);
+} image_kernels;
+
+enum image_simd {
+  IMAGE_SIMD_GENERIC = 0,
+  IMAGE_SIMD_SSE41,
+  IMAGE_SIMD_AVX2
+};
+
+// The selected kernels, set by image_simd_init()
+static const image_kernels *simd = NULL;
+
+void image_simd_init(void);
+int image_simd_supported(int level);
+const char *image_simd_name(void);
+int image_simd_set(const char *name);
@@ -0,0 +1,25 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Source rows kept in memory while streaming, on top of the most a destination row
+// covers, so destination rows can be produced in batches
+#define IMAGE_STREAM_ROWS 16
+
+void image_alloc_rows(image *im, int width, int height);
+pix *image_load_row(image *im, int y);
+int image_load_rows(image *im, int y, int count, pix **rows);
+void image_stream_finish(image *im);
+void image_stream_free(image *im);
@@ -0,0 +1,53 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Encoder for the save_jpeg and save_png resize options
+typedef struct image_writer {
+  FILE *out;            // file being written, or
+  char *path;           // the destination, out is a temporary file renamed to it when done
+  char *tmp_path;
+  SV *sv_buf;           // scalar being written
+  int quality;
+  image_png_options png_options;
+  int rows;             // output rows written so far
+  int failed;           // the encoder had an error, the rest of the output is dropped
+  unsigned char *data;  // one row converted for the encoder
+  pix *bgrow;           // a row of keep_aspect padding
+#ifdef HAVE_JPEG
+  struct jpeg_compress_struct *cinfo;
+  struct jpeg_error_mgr *jerr;
+  struct sv_dst_mgr *dst;
+#endif
+#ifdef HAVE_PNG
+  png_structp png_ptr;
+  png_infop info_ptr;
+#endif
+} image_writer;
+
+void image_writer_open(image *im);
+void image_writer_rows(image *im, int start, int end);
+void image_writer_close(image *im);
+void image_writer_free(image *im);
+
+#ifdef HAVE_JPEG
+void image_jpeg_write_row(image *im, image_writer *w, pix *row);
+void image_jpeg_write_finish(image *im, image_writer *w, int complete);
+#endif
+
+#ifdef HAVE_PNG
+void image_png_write_row(image *im, image_writer *w, pix *row);
+void image_png_write_finish(image *im, image_writer *w, int complete);
+#endif
@@ -49,6 +49,20 @@ sub new {
     return $self;
 }
 
+sub probe {
+    my ( $class, $file, $opts ) = @_;
+
+    return __probe( $file, $opts || {} );
+}
+
+sub probe_many {
+    my ( $class, $files ) = @_;
+
+    my $info = __probe_many($files);
+
+    return wantarray ? @{$info} : $info;
+}
+
 sub resize_gd {
     shift->resize( { %{+shift}, type => IMAGE_SCALE_TYPE_GD } );
 }
@@ -65,6 +79,37 @@ sub resize_gm_fixed_point {
     shift->resize( { %{+shift}, type => IMAGE_SCALE_TYPE_GM_FIXED } );
 }
 
+sub resize_multi {
+    my ( $self, $sizes ) = @_;
+
+    my %types = (
+        resize                => IMAGE_SCALE_TYPE_GD_FIXED,
+        resize_gd             => IMAGE_SCALE_TYPE_GD,
+        resize_gd_fixed_point => IMAGE_SCALE_TYPE_GD_FIXED,
+        resize_gm             => IMAGE_SCALE_TYPE_GM,
+        resize_gm_fixed_point => IMAGE_SCALE_TYPE_GM_FIXED,
+    );
+
+    my @specs;
+    for my $size ( @{$sizes} ) {
+        my %spec = %{$size};
+
+        if ( my $method = delete $spec{method} ) {
+            die "Image::Scale->resize_multi unknown method $method\n" if !exists $types{$method};
+            $spec{type} = $types{$method};
+        }
+
+        push @specs, \%spec;
+    }
+
+    # Each size gets its own object so it can be saved like any other resized image
+    my @images = map { bless { _image => $self->__init_resized() }, ref $self } @specs;
+
+    $self->__resize_multi( \@specs, [ map { $_->{_image} } @images ] ) || return;
+
+    return wantarray ? @images : \@images;
+}
+
 sub DESTROY {
     my $self = shift;
 
@@ -104,7 +149,7 @@ speed and minimal features. Algorithms available are:
   GD's copyResampled (floating-point)
   GD's copyResampled fixed-point (useful on embedded devices/NAS devices)
   GraphicsMagick's assortment of resize filters (floating-point)
-  GraphicsMagick's Triangle filter in fixed-point
+  GraphicsMagick's assortment of resize filters (fixed-point)
 
 Supported image formats include JPEG, GIF, PNG, and BMP for input, and
 JPEG and PNG for output.
@@ -146,6 +191,14 @@ Optionally you can also pass in additional options in a hashref:
 To access an image embedded within another file, such as an audio file, you can
 specify a byte offset and length.
 
+    mmap => 1
+
+Memory-map the file and read it in place the same way as a scalar, instead of through
+a 4K buffer.  Ignored for data in a scalar, small files, files that can't be mapped
+such as pipes, and on platforms without mmap.  Only use this for files that won't
+change while the object exists: if a mapped file is truncated, reading past its new
+end kills the process with SIGBUS instead of reporting an error.
+
 =head2 width()
 
 Returns the width of the original source image.
@@ -154,6 +207,28 @@ Returns the width of the original source image.
 
 Returns the height of the original source image.
 
+=head2 Image::Scale->probe( $PATH or \$DATA, [ \%OPTIONS ] )
+
+Reads just enough of the image header to return its size, without setting up
+a decoder.  Returns a hashref, or undef if the file can't be read or is not a
+JPEG, GIF, PNG, or BMP image:
+
+    {
+        type        => 'jpeg', # or 'png', 'gif', 'bmp'
+        width       => 313,
+        height      => 234,
+        channels    => 3,      # 1 for grayscale, 4 for CMYK JPEG or RGBA PNG, etc
+        orientation => 1,      # from EXIF, always 1 for non-JPEG images
+    }
+
+The width and height are those stored in the file, before any EXIF rotation.
+The offset and length options are the same as for new().
+
+=head2 Image::Scale->probe_many( \@PATHS )
+
+Probes a list of files or scalar refs, returning a list (or arrayref in scalar
+context) of the same hashrefs as probe(), with undef for any that could not be probed.
+
 =head2 resized_width()
 
 Returns the resized width from the last call to resize_*(). Returns 0 if no
@@ -182,7 +257,7 @@ The 4 resize methods available are:
     resize_gd - This is GD's copyResampled algorithm (floating-point)
     resize_gd_fixed_point - copyResampled (converted to fixed-point)
     resize_gm - GraphicsMagick, see below for filter options
-    resize_gm_fixed_point - GraphicsMagick, only the Triangle filter is available in fixed-point mode
+    resize_gm_fixed_point - GraphicsMagick (converted to fixed-point)
 
 Options are specified in a hashref:
 
@@ -194,9 +269,9 @@ image will retain the original aspect ratio.
 
     filter
 
-For use with resize_gm() only.  Choose from the following filters, sorted in order
-from least to most CPU time.  This does not necessarily mean least to best quality, though!
-Be sure to do your own comparisons for quality.
+For use with resize_gm() and resize_gm_fixed_point() only.  Choose from the following
+filters, sorted in order from least to most CPU time.  This does not necessarily mean
+least to best quality, though!  Be sure to do your own comparisons for quality.
 
     Point
     Box
@@ -215,7 +290,10 @@ Be sure to do your own comparisons for quality.
     Sinc
 
 If no filter is specified the default is Lanczos if downsizing, and Mitchell for upsizing or
-if the image has an alpha channel.
+if the image has transparent pixels.  resize_gm_fixed_point() defaults to Triangle.
+
+In fixed-point mode the weights of filters other than Triangle are calculated once per
+resize using floating-point, the filtering itself uses only integer math.
 
     keep_aspect => 1
 
@@ -231,6 +309,22 @@ portion of the image.  Usually this should only be used if saving as JPEG becaus
 will default to transparent.  If this value is set and the image is saved as PNG, the
 PNG will not be transparent.  The default bgcolor value is 0x000000 (black).
 
+    snap => $pixels
+
+JPEG only.  libjpeg can decode a JPEG directly at 1/8, 2/8, ... 8/8 of its size (only
+1/2, 1/4 and 1/8 with older versions of libjpeg), which is much faster than resizing.
+If one of these sizes is within this many pixels of the requested width and height, the
+target is changed to that size and the image is not resampled at all, check
+resized_width() and resized_height() for the actual size.  This is not used with
+keep_aspect or when the image needs to be rotated.
+
+    use_exif_thumbnail => 1
+
+JPEG only.  Digital camera images usually contain a small thumbnail (often 160x120) in
+their EXIF data.  If the requested width and height are no larger than this thumbnail, and
+it has the same aspect ratio as the image, the thumbnail is decoded and resized instead of
+the full image, which is much faster.  The thumbnail is rotated the same as the image.
+
     ignore_exif => 1
 
 By default, if a JPEG image contains an EXIF tag with orientation info, the image will be
@@ -243,23 +337,114 @@ large, you can specify this option. If the resize_*() method would result in a
 total memory allocation greater than $limit_in_bytes, the method will die.
 Be sure to wrap the resize call in an eval when using this option.
 
+resize_gd() and resize_gd_fixed_point() resize JPEG and non-interlaced PNG images
+while they are being decoded, so only a few rows of the source image are in memory
+at once and much larger images fit within a given limit.  Interlaced PNGs can only be
+resized this way when the target is at most 1/8 of the size, as only the first pass
+of the image is then decoded.  The other resize methods
+and image formats decode the whole image first.
+
+libjpeg keeps the whole image in memory while decoding a progressive JPEG, 2 bytes per
+source pixel for each color component (less if the color is subsampled, as it usually is),
+and this is counted towards the limit as well.
+
+    threads => 4
+
+Split the resize across this many threads, for example to cut the latency of resizing
+a single very large image on a machine with many cores.  Rows of the output (and of the
+intermediate image used by resize_gm) are divided between the calling thread and a pool
+of worker threads that is kept around for later resizes.  The output is identical
+regardless of the number of threads.  Decoding the source image is not affected.  The
+default is to use only the calling thread, and this option is ignored on platforms
+without pthreads.
+
+    save_jpeg => $PATH or \$DATA
+    save_png => $PATH or \$DATA
+    quality => 90
+    png_options => { fast => 1 }
+
+Save the resized image as part of the resize, to a file or to a scalar ref, instead of
+calling save_jpeg()/as_png() etc. afterwards.  The resized image is not kept, so as_jpeg()
+and the other output methods cannot be used until the next resize.  quality is the JPEG
+quality, the default is 90, and png_options are the PNG settings passed to save_png().
+The output is identical to saving afterwards.  A file is written to a new, uniquely named
+file next to PATH (PATH.XXXXXX) and renamed to PATH once it is complete, so an existing
+file is left alone if the resize fails.
+
+When resize_gd() or resize_gd_fixed_point() resize a JPEG or non-interlaced PNG while it
+is decoded (see memory_limit above) and no EXIF rotation is needed, rows are encoded as
+soon as they are produced, so neither the source nor the resized image is ever entirely in
+memory.
+
+=head2 resize_multi( \@SIZES )
+
+Resizes the image to several sizes while decoding the source only once, for example
+to build a set of thumbnails.  Each entry in SIZES is a hashref of the same options
+accepted by resize(), plus an optional method, one of 'resize_gd', 'resize_gd_fixed_point',
+'resize_gm', or 'resize_gm_fixed_point' (the default is resize_gd_fixed_point).
+
+    my ($large, $medium, $small) = $img->resize_multi( [
+        { width => 800 },
+        { width => 300 },
+        { width => 100, method => 'resize_gm', filter => 'Lanczos' },
+    ] );
+
+    $small->save_png('small.png');
+
+Returns one new Image::Scale object per size, in the same order, which supports
+resized_width(), resized_height() and the save/as methods.  Returns an arrayref in
+scalar context, and nothing if the image could not be decoded.
+
+Sizes are produced from largest to smallest.  A size is resized from the smallest
+earlier result that is at least twice as large in both dimensions and was not padded
+by keep_aspect, otherwise from the decoded source, so it may differ slightly from what
+resize() would produce.  A memory_limit applies to the total memory used so far by
+the call, and the decode is only limited if every size has one.
+
 =head2 save_jpeg( $PATH, [ $QUALITY ] )
 
 Saves the resized image as a JPEG to PATH. If a quality is not specified, the
-quality defaults to 90.
+quality defaults to 90.  Grayscale images are saved as grayscale JPEGs, unless
+keep_aspect padding with a bgcolor that isn't gray was added.
 
 =head2 as_jpeg( [ $QUALITY ] )
 
 Returns the resized JPEG image as scalar data. If a quality is not specified, the
 quality defaults to 90.
 
-=head2 save_png( $PATH )
+=head2 save_png( $PATH, [ \%OPTIONS ] )
 
 Saves the resized image as a PNG to PATH. Transparency is preserved when saving to PNG.
+The PNG only has an alpha channel if the source image has transparent pixels (an alpha
+channel where every pixel is opaque is dropped), or if keep_aspect padding was added
+without a bgcolor.
 
-=head2 as_png()
+The optional OPTIONS trade file size for encoding speed, the default is libpng's own
+settings.
 
-Returns the resized PNG image as scalar data.
+    compression_level => 0-9
+
+The zlib compression level, the libpng default is 6.
+
+    filter => 'none', 'sub', 'up', 'avg', 'paeth' or 'all'
+
+The filter applied to each row before compression.  'all' tries every filter on every row
+and keeps the best, which is the libpng default for most images and is the slowest.
+
+    strategy => 'default', 'filtered', 'huffman', 'rle' or 'fixed'
+
+The zlib compression strategy.
+
+    fast => 1
+
+Compression level 1 with the up filter, which encodes around 3 times faster than the
+default for files 10-20% larger.  compression_level, filter and strategy override the
+preset.  tools/png_bench.pl compares the size and speed of these settings on a directory
+of PNG images.
+
+=head2 as_png( [ \%OPTIONS ] )
+
+Returns the resized PNG image as scalar data.  OPTIONS are the same as save_png().
 
 =head2 jpeg_version()
 
@@ -270,6 +455,16 @@ Returns the resized PNG image as scalar data.
 Returns the version of the image library used.  Returns undef if support for that image
 format was not built.
 
+=head2 Image::Scale->simd( [ $NAME ] )
+
+Returns the name of the resize kernels in use, one of 'generic', 'sse41', or 'avx2'.
+On x86 CPUs the fastest set the CPU supports is selected the first time an image is
+resized.  Passing a name forces that set, falling back (with a warning) to the best
+supported one if the CPU can't run it.  The IMAGE_SCALE_SIMD environment variable
+can also be used to force a set.  All sets produce identical output from the
+fixed-point resize methods.  The floating-point resize_gm rounds slightly differently with
+each set, so its output can differ by 1 level per channel between CPUs.
+
 =head1 PERFORMANCE
 
 These numbers were gathered on my 2.4ghz MacBook Pro with version 0.06.
@@ -178,8 +178,9 @@ image_bmp_load(image *im)
     }
     else {
       // reset SV read
-      im->sv_offset = MIN(sv_len(im->sv_data) - im->image_offset, BUFFER_SIZE);
-      buffer_append(im->buf, SvPVX(im->sv_data) + im->image_offset, im->sv_offset);
+      int len = MIN(image_data_len(im) - im->image_offset, BUFFER_SIZE);
+      buffer_append(im->buf, image_data_ptr(im) + im->image_offset, len);
+      im->sv_offset = im->image_offset + len;
     }
 
     image_bmp_read_header(im);
@@ -206,8 +207,17 @@ image_bmp_load(image *im)
 
   DEBUG_TRACE("linebits %d, paddingbits %d, linebytes %d\n", im->width * im->bpp, paddingbits, linebytes);
 
-  bptr = buffer_ptr(im->buf);
-  blen = buffer_len(im->buf);
+  if (im->fh != NULL) {
+    bptr = buffer_ptr(im->buf);
+    blen = buffer_len(im->buf);
+  }
+  else {
+    // Read the rest of the scalar or mapped file in place, starting after the header
+    int pos = im->sv_offset - buffer_len(im->buf);
+
+    bptr = image_data_ptr(im) + pos;
+    blen = image_data_len(im) - pos;
+  }
 
   // Allocate storage for decompressed image
 	image_alloc(im, im->width, im->height);
@@ -237,27 +247,15 @@ image_bmp_load(image *im)
         if (blen < 0)
           blen = 0;
 
-        buffer_consume(im->buf, buffer_len(im->buf) - blen);
-
+        // Read from file, in-memory data was all available already
         if (im->fh != NULL) {
-          // Read from file
-          if ( !_check_buf(im->fh, im->buf, im->channels, 8192) ) {
-            image_bmp_finish(im);
-            warn("Image::Scale unable to read entire BMP file (%s)\n", SvPVX(im->path));
-            return 0;
-          }
+          buffer_consume(im->buf, buffer_len(im->buf) - blen);
         }
-        else {
-          // Read from scalar
-          int svbuflen = MIN(sv_len(im->sv_data) - im->sv_offset, 8192);
-
-          if (!svbuflen) {
-            image_bmp_finish(im);
-            warn("Image::Scale unable to read entire BMP file (%s)\n", SvPVX(im->path));
-            return 0;
-          }
-          buffer_append(im->buf, SvPVX(im->sv_data) + im->sv_offset, svbuflen);
-          im->sv_offset += svbuflen;
+
+        if ( im->fh == NULL || !_check_buf(im->fh, im->buf, im->channels, 8192) ) {
+          image_bmp_finish(im);
+          warn("Image::Scale unable to read entire BMP file (%s)\n", SvPVX(im->path));
+          return 0;
         }
 
         bptr = buffer_ptr(im->buf);
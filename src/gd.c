@@ -1,345 +1,635 @@
 // Port of GD copyResampled
 #define floor2(exp) ((int) exp)
 
-void
-image_downsize_gd(image *im)
+// copyResampled merges every source pixel that overlaps a destination pixel,
+// weighted by how much of it is covered in each direction.  The covered span
+// only depends on the column (or row) being produced, so it is calculated once
+// per resize instead of once per destination pixel.
+typedef struct {
+  int32_t start;  // first source pixel
+  int32_t count;  // number of source pixels
+  int32_t offset; // index of the first portion
+} gd_span;
+
+// The number of source pixels a span can touch is at most (int)scale + 2
+#define GD_SPAN_PORTIONS(dst_len, scale) ((dst_len) * ((int)(scale) + 2))
+
+static void
+image_gd_spans(int32_t dst_len, int32_t src_len, float scale, gd_span *spans, float *portions)
 {
-  int x, y;
-  float sy1, sy2, sx1, sx2;
-  int dstX = 0, dstY = 0, srcX = 0, srcY = 0;
-  float width_scale, height_scale;
+  int i, n = 0;
 
-  int dstW = im->target_width;
-  int dstH = im->target_height;
-  int srcW = im->width;
-  int srcH = im->height;
+  for (i = 0; i < dst_len; i++) {
+    float s1 = (float)i * scale;
+    float s2 = (float)(i + 1) * scale;
+    float s = s1;
 
-  if (im->height_padding) {
-    dstY = im->height_padding;
-    dstH = im->height_inner;
-  }
+    spans[i].start  = floor2(s1);
+    spans[i].offset = n;
 
-  if (im->width_padding) {
-    dstX = im->width_padding;
-    dstW = im->width_inner;
+    do {
+      float portion;
+
+      if (floor2(s) == floor2(s1)) {
+        portion = 1.0 - (s - floor2(s));
+        if (portion > s2 - s1) {
+          portion = s2 - s1;
+        }
+        s = floor2(s);
+      }
+      else if (s == floor2(s2)) {
+        portion = s2 - floor2(s2);
+      }
+      else {
+        portion = 1.0;
+      }
+
+      portions[n++] = portion;
+      s += 1.0;
+    } while (s < s2);
+
+    spans[i].count = n - spans[i].offset;
+
+    // Float rounding can leave a sliver of weight past the last source pixel
+    if (spans[i].start + spans[i].count > src_len)
+      spans[i].count = src_len - spans[i].start;
   }
+}
 
-  width_scale = (float)srcW / dstW;
-  height_scale = (float)srcH / dstH;
+static void
+image_gd_spans_fixed(int32_t dst_len, fixed_t scale, gd_span *spans, fixed_t *portions)
+{
+  int i, n = 0;
 
-  for (y = dstY; (y < dstY + dstH); y++) {
-    sy1 = (float)(y - dstY) * height_scale;
-    sy2 = (float)((y + 1) - dstY) * height_scale;
+  for (i = 0; i < dst_len; i++) {
+    fixed_t s1 = fixed_mul(int_to_fixed(i), scale);
+    fixed_t s2 = fixed_mul(int_to_fixed(i + 1), scale);
+    fixed_t s = s1;
 
-    for (x = dstX; (x < dstX + dstW); x++) {
-      float sx, sy;
-  	  float spixels = 0;
-  	  float red = 0.0, green = 0.0, blue = 0.0, alpha = 0.0;
+    spans[i].start  = fixed_to_int(s1);
+    spans[i].offset = n;
 
-  	  if (!im->has_alpha)
-        alpha = 255.0;
+    do {
+      fixed_t portion;
 
-  	  sx1 = (float)(x - dstX) * width_scale;
-  	  sx2 = (float)((x + 1) - dstX) * width_scale;
-  	  sy = sy1;
-
-      //DEBUG_TRACE("sx1 %.2f, sx2 %.2f, sy1 %.2f, sy2 %.2f\n", sx1, sx2, sy1, sy2);
-
-  	  do {
-        float yportion;
-
-        //DEBUG_TRACE("  yportion(sy %.2f, sy1 %.2f, sy2 %.2f) = ", sy, sy1, sy2);
-        if (floor2(sy) == floor2(sy1)) {
-          yportion = 1.0 - (sy - floor2(sy));
-    		  if (yportion > sy2 - sy1) {
-            yportion = sy2 - sy1;
-    		  }
-    		  sy = floor2(sy);
-    		}
-    		else if (sy == floor2(sy2)) {
-          yportion = sy2 - floor2(sy2);
+      if (fixed_floor(s) == fixed_floor(s1)) {
+        portion = FIXED_1 - (s - fixed_floor(s));
+        if (portion > s2 - s1) {
+          portion = s2 - s1;
         }
-        else {
-          yportion = 1.0;
-        }
-        //DEBUG_TRACE("%.2f\n", yportion);
-
-        sx = sx1;
-
-        do {
-          float xportion = 1.0;
-    		  float pcontribution;
-    		  pix p;
-
-    		  //DEBUG_TRACE("  xportion(sx %.2f, sx1 %.2f, sx2 %.2f) = ", sx, sx1, sx2);
-    		  if (floor2(sx) == floor2(sx1)) {
-    	      xportion = 1.0 - (sx - floor2(sx));
-    	      if (xportion > sx2 - sx1)	{
-              xportion = sx2 - sx1;
-    			  }
-    		    sx = floor2(sx);
-    		  }
-    		  else if (sx == floor2(sx2)) {
-            xportion = sx2 - floor2(sx2);
-          }
-    		  else {
-    		    xportion = 1.0;
-    		  }
-    		  //DEBUG_TRACE("%.2f\n", xportion);
+        s = fixed_floor(s);
+      }
+      else if (s == fixed_floor(s2)) {
+        portion = s2 - fixed_floor(s2);
+      }
+      else {
+        portion = FIXED_1;
+      }
 
-    		  pcontribution = xportion * yportion;
+      portions[n++] = portion;
+      s += FIXED_1;
+    } while (s < s2);
 
-    		  p = get_pix(im, (int32_t)sx + srcX, (int32_t)sy + srcY);
+    spans[i].count = n - spans[i].offset;
+  }
+}
 
-    		  /*
-    		  DEBUG_TRACE("  merging with pix %d, %d: src %x (%d %d %d %d), pcontribution %.2f\n",
-            (int32_t)sx + srcX, (int32_t)sy + srcY,
-            p, COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p), pcontribution);
-          */
+static inline void
+image_gd_put_pix(image *im, int x, int y, pix col)
+{
+  if (im->orientation != ORIENTATION_NORMAL) {
+    int ox, oy; // new destination pixel coordinates after rotating
 
-    		  red   += COL_RED(p)   * pcontribution;
-    		  green += COL_GREEN(p) * pcontribution;
-    		  blue  += COL_BLUE(p)  * pcontribution;
+    image_get_rotated_coords(im, x, y, &ox, &oy);
 
-    		  if (im->has_alpha)
-    		    alpha += COL_ALPHA(p) * pcontribution;
+    if (im->orientation >= 5) {
+      // 90 and 270 rotations, width/height are swapped so we have to use alternate put_pix method
+      put_pix_rotated(im, ox, oy, im->target_height, col);
+    }
+    else {
+      put_pix(im, ox, oy, col);
+    }
+  }
+  else {
+    put_pix(im, x, y, col);
+  }
+}
 
-    		  spixels += pcontribution;
-    		  sx += 1.0;
-    		} while (sx < sx2);
+typedef struct {
+  int dstX, dstY, dstW, dstH;
+  gd_span *xspans, *yspans;
+  float *xportions, *yportions;
+  float *sums; // red, green, blue, alpha, spixels for each destination column, for each part
+} gd_tables;
+
+// Each destination row is accumulated by walking its source rows in memory order.
+// Every pixel still sums its source pixels row by row with the same float products
+// as GD, so the output doesn't change.
+static void
+image_downsize_gd_rows(image *im, void *arg, int part, int start, int end)
+{
+  gd_tables *t = (gd_tables *)arg;
+  int x, y, i, j;
+  float *sums = &t->sums[part * t->dstW * 5];
+
+  for (y = start; y < end; y++) {
+    Zero(sums, t->dstW * 5, float);
+
+    for (j = 0; j < t->yspans[y].count; j++) {
+      float yportion = t->yportions[t->yspans[y].offset + j];
+      pix *row = image_row(im, t->yspans[y].start + j);
+      float *s = sums;
+
+      for (x = 0; x < t->dstW; x++) {
+        pix *p = row + t->xspans[x].start;
+        float *xportion = t->xportions + t->xspans[x].offset;
+        float red = s[0], green = s[1], blue = s[2], alpha = s[3], spixels = s[4];
+
+        if (im->has_alpha) {
+          for (i = 0; i < t->xspans[x].count; i++) {
+            float pcontribution = xportion[i] * yportion;
+
+            red   += COL_RED(p[i])   * pcontribution;
+            green += COL_GREEN(p[i]) * pcontribution;
+            blue  += COL_BLUE(p[i])  * pcontribution;
+            alpha += COL_ALPHA(p[i]) * pcontribution;
+            spixels += pcontribution;
+          }
+        }
+        else {
+          for (i = 0; i < t->xspans[x].count; i++) {
+            float pcontribution = xportion[i] * yportion;
 
-    		sy += 1.0;
-      } while (sy < sy2);
+            red   += COL_RED(p[i])   * pcontribution;
+            green += COL_GREEN(p[i]) * pcontribution;
+            blue  += COL_BLUE(p[i])  * pcontribution;
+            spixels += pcontribution;
+          }
+        }
+
+        s[0] = red;
+        s[1] = green;
+        s[2] = blue;
+        s[3] = alpha;
+        s[4] = spixels;
+        s += 5;
+      }
+    }
+
+    for (x = 0; x < t->dstW; x++) {
+      float *s = &sums[x * 5];
+      float red = s[0], green = s[1], blue = s[2], alpha = s[3];
+      float spixels = s[4];
+
+      if (!im->has_alpha)
+        alpha = 255.0;
 
       if (spixels != 0.0) {
-        //DEBUG_TRACE("  rgba (%.2f %.2f %.2f %.2f) spixels %.2f\n", red, green, blue, alpha, spixels);
         spixels = 1 / spixels;
-	      red   *= spixels;
-	      green *= spixels;
-	      blue  *= spixels;
+        red   *= spixels;
+        green *= spixels;
+        blue  *= spixels;
 
-	      if (im->has_alpha)
-	        alpha *= spixels;
-	    }
+        if (im->has_alpha)
+          alpha *= spixels;
+      }
 
-	    /* Clamping to allow for rounding errors above */
+      /* Clamping to allow for rounding errors above */
       if (red > 255.0)   red = 255.0;
       if (green > 255.0) green = 255.0;
       if (blue > 255.0)  blue = 255.0;
       if (im->has_alpha && alpha > 255.0) alpha = 255.0;
 
-      /*
-      DEBUG_TRACE("  -> %d, %d %x (%d %d %d %d)\n",
-        x, y, COL_FULL((int)red, (int)green, (int)blue, (int)alpha),
-        (int)red, (int)green, (int)blue, (int)alpha);
-      */
+      image_gd_put_pix(
+        im, x + t->dstX, y + t->dstY,
+        COL_FULL(ROUND_FLOAT_TO_INT(red), ROUND_FLOAT_TO_INT(green), ROUND_FLOAT_TO_INT(blue), ROUND_FLOAT_TO_INT(alpha))
+      );
+    }
+  }
+}
+
+static void
+image_gd_tables_init(image *im, gd_tables *t)
+{
+  float width_scale, height_scale;
+
+  t->dstX = 0;
+  t->dstY = 0;
+  t->dstW = im->target_width;
+  t->dstH = im->target_height;
 
-      if (im->orientation != ORIENTATION_NORMAL) {
-        int ox, oy; // new destination pixel coordinates after rotating
+  if (im->height_padding) {
+    t->dstY = im->height_padding;
+    t->dstH = im->height_inner;
+  }
 
-        image_get_rotated_coords(im, x, y, &ox, &oy);
+  if (im->width_padding) {
+    t->dstX = im->width_padding;
+    t->dstW = im->width_inner;
+  }
 
-        if (im->orientation >= 5) {
-          // 90 and 270 rotations, width/height are swapped so we have to use alternate put_pix method
-          put_pix_rotated(
-            im, ox, oy, im->target_height,
-            COL_FULL(ROUND_FLOAT_TO_INT(red), ROUND_FLOAT_TO_INT(green), ROUND_FLOAT_TO_INT(blue), ROUND_FLOAT_TO_INT(alpha))
-          );
-        }
-        else {
-          put_pix(
-            im, ox, oy,
-            COL_FULL(ROUND_FLOAT_TO_INT(red), ROUND_FLOAT_TO_INT(green), ROUND_FLOAT_TO_INT(blue), ROUND_FLOAT_TO_INT(alpha))
-          );
-        }
-      }
-      else {
-        put_pix(
-          im, x, y,
-          COL_FULL(ROUND_FLOAT_TO_INT(red), ROUND_FLOAT_TO_INT(green), ROUND_FLOAT_TO_INT(blue), ROUND_FLOAT_TO_INT(alpha))
-        );
-      }
-    }
-	}
+  width_scale = (float)im->width / t->dstW;
+  height_scale = (float)im->height / t->dstH;
+
+  New(0, t->xspans, t->dstW, gd_span);
+  New(0, t->yspans, t->dstH, gd_span);
+  New(0, t->xportions, GD_SPAN_PORTIONS(t->dstW, width_scale), float);
+  New(0, t->yportions, GD_SPAN_PORTIONS(t->dstH, height_scale), float);
+  New(0, t->sums, image_pool_parts(im, t->dstH) * t->dstW * 5, float);
+
+  image_gd_spans(t->dstW, im->width, width_scale, t->xspans, t->xportions);
+  image_gd_spans(t->dstH, im->height, height_scale, t->yspans, t->yportions);
+}
+
+static void
+image_gd_tables_free(gd_tables *t)
+{
+  Safefree(t->xspans);
+  Safefree(t->yspans);
+  Safefree(t->xportions);
+  Safefree(t->yportions);
+  Safefree(t->sums);
 }
 
 void
-image_downsize_gd_fixed_point(image *im)
+image_downsize_gd(image *im)
+{
+  gd_tables t;
+
+  image_gd_tables_init(im, &t);
+
+  image_pool_run(im, t.dstH, image_downsize_gd_rows, &t);
+
+  image_gd_tables_free(&t);
+}
+
+// The fixed-point version works the same way as the floating-point one above, with
+// fixed_mul(xportion, yportion) as the weight of each source pixel.
+
+// Per-thread state of a fixed-point resize
+typedef struct {
+  fixed_t *sums;      // accumulators for one destination row, dstW * 5
+  int overflow;       // set if the sums overflowed
+  fixed_t values[4];  // the overflowed rgba sums
+} gd_fixed_part;
+
+typedef struct {
+  int dstX, dstY, dstW, dstH;
+  gd_span *xspans, *yspans;
+  fixed_t *xportions, *yportions;
+  gd_fixed_part *parts;
+} gd_fixed_tables;
+
+// Finish one destination pixel, returns 0 if the sums overflowed
+static int
+image_gd_fixed_finish_pix(image *im, gd_fixed_part *part, int x, int y,
+  fixed_t red, fixed_t green, fixed_t blue, fixed_t alpha, fixed_t spixels)
+{
+  if (!im->has_alpha)
+    alpha = FIXED_255;
+
+  // If rgba get too large for the fixed-point representation, fallback to the floating point routine
+  // This should only happen with very large images
+  if (red < 0 || green < 0 || blue < 0 || alpha < 0) {
+    part->overflow  = 1;
+    part->values[0] = red;
+    part->values[1] = green;
+    part->values[2] = blue;
+    part->values[3] = alpha;
+    return 0;
+  }
+
+  if (spixels != 0) {
+    spixels = fixed_div(FIXED_1, spixels);
+
+    red   = fixed_mul(red, spixels);
+    green = fixed_mul(green, spixels);
+    blue  = fixed_mul(blue, spixels);
+
+    if (im->has_alpha)
+      alpha = fixed_mul(alpha, spixels);
+  }
+
+  /* Clamping to allow for rounding errors above */
+  if (red > FIXED_255)   red = FIXED_255;
+  if (green > FIXED_255) green = FIXED_255;
+  if (blue > FIXED_255)  blue = FIXED_255;
+  if (im->has_alpha && alpha > FIXED_255) alpha = FIXED_255;
+
+  image_gd_put_pix(
+    im, x, y,
+    COL_FULL(fixed_to_int(red), fixed_to_int(green), fixed_to_int(blue), fixed_to_int(alpha))
+  );
+
+  return 1;
+}
+
+static void
+image_gd_fixed_tables_init(image *im, gd_fixed_tables *t)
 {
-  int x, y;
-  fixed_t sy1, sy2, sx1, sx2;
-  int dstX = 0, dstY = 0, srcX = 0, srcY = 0;
   fixed_t width_scale, height_scale;
+  int i, parts;
 
-  int dstW = im->target_width;
-  int dstH = im->target_height;
-  int srcW = im->width;
-  int srcH = im->height;
+  t->dstX = 0;
+  t->dstY = 0;
+  t->dstW = im->target_width;
+  t->dstH = im->target_height;
 
   if (im->height_padding) {
-    dstY = im->height_padding;
-    dstH = im->height_inner;
+    t->dstY = im->height_padding;
+    t->dstH = im->height_inner;
   }
 
   if (im->width_padding) {
-    dstX = im->width_padding;
-    dstW = im->width_inner;
+    t->dstX = im->width_padding;
+    t->dstW = im->width_inner;
   }
 
-  width_scale = fixed_div(int_to_fixed(srcW), int_to_fixed(dstW));
-  height_scale = fixed_div(int_to_fixed(srcH), int_to_fixed(dstH));
+  width_scale = fixed_div(int_to_fixed(im->width), int_to_fixed(t->dstW));
+  height_scale = fixed_div(int_to_fixed(im->height), int_to_fixed(t->dstH));
 
-  for (y = dstY; (y < dstY + dstH); y++) {
-    sy1 = fixed_mul(int_to_fixed(y - dstY), height_scale);
-    sy2 = fixed_mul(int_to_fixed((y + 1) - dstY), height_scale);
+  New(0, t->xspans, t->dstW, gd_span);
+  New(0, t->yspans, t->dstH, gd_span);
+  New(0, t->xportions, GD_SPAN_PORTIONS(t->dstW, fixed_to_int(width_scale)), fixed_t);
+  New(0, t->yportions, GD_SPAN_PORTIONS(t->dstH, fixed_to_int(height_scale)), fixed_t);
 
-    for (x = dstX; (x < dstX + dstW); x++) {
-      fixed_t sx, sy;
-  	  fixed_t spixels = 0;
-  	  fixed_t red = 0, green = 0, blue = 0, alpha = 0;
+  image_gd_spans_fixed(t->dstW, width_scale, t->xspans, t->xportions);
+  image_gd_spans_fixed(t->dstH, height_scale, t->yspans, t->yportions);
 
-  	  if (!im->has_alpha)
-        alpha = FIXED_255;
+  // The SIMD kernels use the same 20 bytes per column as 16-byte vectors followed by spixels
+  parts = image_pool_parts(im, t->dstH);
+  Newz(0, t->parts, parts, gd_fixed_part);
+  for (i = 0; i < parts; i++)
+    New(0, t->parts[i].sums, t->dstW * 5, fixed_t);
+}
 
-      sx1 = fixed_mul(int_to_fixed(x - dstX), width_scale);
-      sx2 = fixed_mul(int_to_fixed((x + 1) - dstX), width_scale);
-  	  sy = sy1;
+static void
+image_gd_fixed_tables_free(image *im, gd_fixed_tables *t)
+{
+  int i;
 
-  	  /*
-      DEBUG_TRACE("sx1 %f, sx2 %f, sy1 %f, sy2 %f\n",
-        fixed_to_float(sx1), fixed_to_float(sx2), fixed_to_float(sy1), fixed_to_float(sy2));
-      */
+  for (i = 0; i < image_pool_parts(im, t->dstH); i++)
+    Safefree(t->parts[i].sums);
 
-  	  do {
-        fixed_t yportion;
+  Safefree(t->parts);
+  Safefree(t->xspans);
+  Safefree(t->yspans);
+  Safefree(t->xportions);
+  Safefree(t->yportions);
+}
 
-        //DEBUG_TRACE("  yportion(sy %f, sy1 %f, sy2 %f) = ", fixed_to_float(sy), fixed_to_float(sy1), fixed_to_float(sy2));
+// With large enough scales the sums can overflow.  They don't always wrap around to a
+// negative value, so the floating-point version is used whenever an overflow is possible.
+static int
+image_gd_fixed_may_overflow(gd_fixed_tables *t)
+{
+  int64_t xmax = 0, ymax = 0;
+  int i, j;
+
+  for (i = 0; i < t->dstW; i++) {
+    int64_t sum = 0;
+    for (j = 0; j < t->xspans[i].count; j++)
+      sum += t->xportions[t->xspans[i].offset + j];
+    xmax = MAX(xmax, sum);
+  }
 
-        if (fixed_floor(sy) == fixed_floor(sy1)) {
-          yportion = FIXED_1 - (sy - fixed_floor(sy));
-    		  if (yportion > sy2 - sy1) {
-            yportion = sy2 - sy1;
-    		  }
-    		  sy = fixed_floor(sy);
-    		}
-    		else if (sy == fixed_floor(sy2)) {
-          yportion = sy2 - fixed_floor(sy2);
-        }
-        else {
-          yportion = FIXED_1;
-        }
+  for (i = 0; i < t->dstH; i++) {
+    int64_t sum = 0;
+    for (j = 0; j < t->yspans[i].count; j++)
+      sum += t->yportions[t->yspans[i].offset + j];
+    ymax = MAX(ymax, sum);
+  }
 
-        //DEBUG_TRACE("%f\n", fixed_to_float(yportion));
+  return 255 * (xmax * ymax / FIXED_1) > INT32_MAX;
+}
 
-        sx = sx1;
+void
+image_downsize_gd_fixed_point(image *im)
+{
+  gd_fixed_tables t;
+  int i;
 
-        do {
-          fixed_t xportion;
-    		  fixed_t pcontribution;
-    		  pix p;
+  image_gd_fixed_tables_init(im, &t);
 
-    		  //DEBUG_TRACE("  xportion(sx %f, sx1 %f, sx2 %f) = ", fixed_to_float(sx), fixed_to_float(sx1), fixed_to_float(sx2));
+  if ( image_gd_fixed_may_overflow(&t) ) {
+    DEBUG_TRACE("Fixed-point sums may overflow, using floating-point\n");
+    image_gd_fixed_tables_free(im, &t);
+    return image_downsize_gd(im);
+  }
 
-    		  if (fixed_floor(sx) == fixed_floor(sx1)) {
-    	      xportion = FIXED_1 - (sx - fixed_floor(sx));
-    	      if (xportion > sx2 - sx1)	{
-              xportion = sx2 - sx1;
-    			  }
-    		    sx = fixed_floor(sx);
-    		  }
-    		  else if (sx == fixed_floor(sx2)) {
-            xportion = sx2 - fixed_floor(sx2);
-          }
-    		  else {
-    		    xportion = FIXED_1;
-    		  }
+  image_pool_run(im, t.dstH, simd->gd_fixed_point_rows, &t);
 
-    		  //DEBUG_TRACE("%f\n", fixed_to_float(xportion));
+  for (i = 0; i < image_pool_parts(im, t.dstH); i++) {
+    if (t.parts[i].overflow) {
+      warn("fixed-point overflow: %d %d %d %d\n",
+        t.parts[i].values[0], t.parts[i].values[1], t.parts[i].values[2], t.parts[i].values[3]);
+      image_gd_fixed_tables_free(im, &t);
+      return image_downsize_gd(im);
+    }
+  }
 
-    		  pcontribution = fixed_mul(xportion, yportion);
+  image_gd_fixed_tables_free(im, &t);
+}
 
-    		  p = get_pix(im, fixed_to_int(sx + srcX), fixed_to_int(sy + srcY));
+static void
+image_downsize_gd_fixed_point_rows_generic(image *im, void *arg, int part, int start, int end)
+{
+  gd_fixed_tables *t = (gd_fixed_tables *)arg;
+  int x, y, i, j;
+  fixed_t *sums = t->parts[part].sums; // red, green, blue, alpha, spixels for each destination column
+
+  for (y = start; y < end; y++) {
+    Zero(sums, t->dstW * 5, fixed_t);
+
+    for (j = 0; j < t->yspans[y].count; j++) {
+      fixed_t yportion = t->yportions[t->yspans[y].offset + j];
+      pix *row = image_row(im, t->yspans[y].start + j);
+      fixed_t *s = sums;
+
+      for (x = 0; x < t->dstW; x++) {
+        pix *p = row + t->xspans[x].start;
+        fixed_t *xportion = t->xportions + t->xspans[x].offset;
+        fixed_t red = s[0], green = s[1], blue = s[2], alpha = s[3], spixels = s[4];
+
+        for (i = 0; i < t->xspans[x].count; i++) {
+          fixed_t pcontribution = fixed_mul(xportion[i], yportion);
+
+          // fixed_mul(int_to_fixed(c), pcontribution) == c * pcontribution for 8-bit c
+          red   += (fixed_t)COL_RED(p[i])   * pcontribution;
+          green += (fixed_t)COL_GREEN(p[i]) * pcontribution;
+          blue  += (fixed_t)COL_BLUE(p[i])  * pcontribution;
+          alpha += (fixed_t)COL_ALPHA(p[i]) * pcontribution;
+          spixels += pcontribution;
+        }
 
-    		  /*
-    		  DEBUG_TRACE("  merging with pix %d, %d: src %x (%d %d %d %d), pcontribution %f\n",
-            fixed_to_int(sx + srcX), fixed_to_int(sy + srcY),
-            p, COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p), fixed_to_float(pcontribution));
-          */
+        s[0] = red;
+        s[1] = green;
+        s[2] = blue;
+        s[3] = alpha;
+        s[4] = spixels;
+        s += 5;
+      }
+    }
 
-          red   += fixed_mul(int_to_fixed(COL_RED(p)), pcontribution);
-          green += fixed_mul(int_to_fixed(COL_GREEN(p)), pcontribution);
-    		  blue  += fixed_mul(int_to_fixed(COL_BLUE(p)), pcontribution);
+    for (x = 0; x < t->dstW; x++) {
+      fixed_t *s = &sums[x * 5];
 
-    		  if (im->has_alpha)
-    		    alpha += fixed_mul(int_to_fixed(COL_ALPHA(p)), pcontribution);
+      if ( !image_gd_fixed_finish_pix(im, &t->parts[part], x + t->dstX, y + t->dstY, s[0], s[1], s[2], s[3], s[4]) )
+        return;
+    }
+  }
+}
 
-    		  spixels += pcontribution;
-    		  sx += FIXED_1;
-    		} while (sx < sx2);
+#ifdef HAVE_SIMD
+// SIMD versions of image_downsize_gd_fixed_point.  All four channels of a pix are
+// accumulated in one register, and source pixels are merged in pairs with pmaddwd,
+// which computes c1 * w1 + c2 * w2 for each channel.  Since
+// fixed_mul(int_to_fixed(c), w) == c * w for 8-bit channels, the sums (and
+// therefore the output) are identical to the scalar version.
+
+// Interleaves the bytes of adjacent pixels so each channel of a pair is side by side
+#define GD_SIMD_INTERLEAVE 0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15
+
+// Weights of a pair, c1 is multiplied by the low half and c2 by the high half
+#define GD_SIMD_WEIGHTS(w1, w2) ( ((w2) << 16) | (w1) )
+
+// Add (p[0] * w1) + (p[1] * w2) to the 4 x 32-bit accumulator, lanes are in pix byte order (A, B, G, R)
+#define GD_SSE41_MERGE2(acc, p, w1, w2) \
+  acc = _mm_add_epi32(acc, _mm_madd_epi16( \
+    _mm_cvtepu8_epi16( _mm_shuffle_epi8(_mm_loadl_epi64((__m128i *)(p)), interleave) ), \
+    _mm_set1_epi32( GD_SIMD_WEIGHTS(w1, w2) ) \
+  ))
+
+// Add p[0] * w1 to the accumulator
+#define GD_SSE41_MERGE1(acc, p, w1) \
+  acc = _mm_add_epi32(acc, _mm_madd_epi16( \
+    _mm_cvtepu8_epi32( _mm_cvtsi32_si128(*(p)) ), \
+    _mm_set1_epi32(w1) \
+  ))
+
+static void TARGET_SSE41
+image_downsize_gd_fixed_point_rows_sse41(image *im, void *arg, int part, int start, int end)
+{
+  gd_fixed_tables *t = (gd_fixed_tables *)arg;
+  int x, y, i, j;
+  __m128i *sums = (__m128i *)t->parts[part].sums;
+  fixed_t *spixels = (fixed_t *)(sums + t->dstW);
+  const __m128i interleave = _mm_setr_epi8(GD_SIMD_INTERLEAVE);
+
+  for (y = start; y < end; y++) {
+    Zero(sums, t->dstW, __m128i);
+    Zero(spixels, t->dstW, fixed_t);
+
+    for (j = 0; j < t->yspans[y].count; j++) {
+      fixed_t yportion = t->yportions[t->yspans[y].offset + j];
+      pix *row = image_row(im, t->yspans[y].start + j);
+
+      for (x = 0; x < t->dstW; x++) {
+        pix *p = row + t->xspans[x].start;
+        fixed_t *xportion = t->xportions + t->xspans[x].offset;
+        int n = t->xspans[x].count;
+        __m128i acc = _mm_loadu_si128(&sums[x]);
+        fixed_t w1, w2;
+
+        // Always in the range 0 - FIXED_1 so they fit in a signed 16-bit lane
+        for (i = 0; i + 1 < n; i += 2) {
+          w1 = fixed_mul(xportion[i], yportion);
+          w2 = fixed_mul(xportion[i + 1], yportion);
+          GD_SSE41_MERGE2(acc, p + i, w1, w2);
+          spixels[x] += w1 + w2;
+        }
 
-        sy += FIXED_1;
-      } while (sy < sy2);
+        if (i < n) {
+          w1 = fixed_mul(xportion[i], yportion);
+          GD_SSE41_MERGE1(acc, p + i, w1);
+          spixels[x] += w1;
+        }
 
-  	  // If rgba get too large for the fixed-point representation, fallback to the floating point routine
-		  // This should only happen with very large images
-		  if (red < 0 || green < 0 || blue < 0 || alpha < 0) {
-        warn("fixed-point overflow: %d %d %d %d\n", red, green, blue, alpha);
-        return image_downsize_gd(im);
+        _mm_storeu_si128(&sums[x], acc);
       }
+    }
+
+    for (x = 0; x < t->dstW; x++) {
+      int32_t s[4];
+
+      _mm_storeu_si128((__m128i *)s, _mm_loadu_si128(&sums[x]));
 
-      if (spixels != 0) {
-        /*
-        DEBUG_TRACE("  rgba (%f %f %f %f) spixels %f\n",
-          fixed_to_float(red), fixed_to_float(green), fixed_to_float(blue), fixed_to_float(alpha), fixed_to_float(spixels));
-        */
+      if ( !image_gd_fixed_finish_pix(im, &t->parts[part], x + t->dstX, y + t->dstY, s[3], s[2], s[1], s[0], spixels[x]) )
+        return;
+    }
+  }
+}
 
-        spixels = fixed_div(FIXED_1, spixels);
+// The AVX2 version merges 4 source pixels at a time
+static void TARGET_AVX2
+image_downsize_gd_fixed_point_rows_avx2(image *im, void *arg, int part, int start, int end)
+{
+  gd_fixed_tables *t = (gd_fixed_tables *)arg;
+  int x, y, i, j;
+  __m128i *sums = (__m128i *)t->parts[part].sums;
+  fixed_t *spixels = (fixed_t *)(sums + t->dstW);
+  const __m128i interleave = _mm_setr_epi8(GD_SIMD_INTERLEAVE);
+
+  for (y = start; y < end; y++) {
+    Zero(sums, t->dstW, __m128i);
+    Zero(spixels, t->dstW, fixed_t);
+
+    for (j = 0; j < t->yspans[y].count; j++) {
+      fixed_t yportion = t->yportions[t->yspans[y].offset + j];
+      pix *row = image_row(im, t->yspans[y].start + j);
+
+      for (x = 0; x < t->dstW; x++) {
+        pix *p = row + t->xspans[x].start;
+        fixed_t *xportion = t->xportions + t->xspans[x].offset;
+        int n = t->xspans[x].count;
+        __m256i acc4 = _mm256_setzero_si256();
+        __m128i acc;
+        fixed_t w1, w2, w3, w4;
+
+        for (i = 0; i + 3 < n; i += 4) {
+          w1 = fixed_mul(xportion[i], yportion);
+          w2 = fixed_mul(xportion[i + 1], yportion);
+          w3 = fixed_mul(xportion[i + 2], yportion);
+          w4 = fixed_mul(xportion[i + 3], yportion);
+
+          acc4 = _mm256_add_epi32(acc4, _mm256_madd_epi16(
+            _mm256_cvtepu8_epi16( _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(p + i)), interleave) ),
+            _mm256_setr_epi32(
+              GD_SIMD_WEIGHTS(w1, w2), GD_SIMD_WEIGHTS(w1, w2), GD_SIMD_WEIGHTS(w1, w2), GD_SIMD_WEIGHTS(w1, w2),
+              GD_SIMD_WEIGHTS(w3, w4), GD_SIMD_WEIGHTS(w3, w4), GD_SIMD_WEIGHTS(w3, w4), GD_SIMD_WEIGHTS(w3, w4)
+            )
+          ));
+          spixels[x] += w1 + w2 + w3 + w4;
+        }
 
-        red   = fixed_mul(red, spixels);
-        green = fixed_mul(green, spixels);
-        blue  = fixed_mul(blue, spixels);
+        acc = _mm_add_epi32( _mm_loadu_si128(&sums[x]),
+          _mm_add_epi32(_mm256_castsi256_si128(acc4), _mm256_extracti128_si256(acc4, 1)) );
 
-        if (im->has_alpha)
-          alpha = fixed_mul(alpha, spixels);
-	    }
-
-	    /* Clamping to allow for rounding errors above */
-      if (red > FIXED_255)   red = FIXED_255;
-      if (green > FIXED_255) green = FIXED_255;
-      if (blue > FIXED_255)  blue = FIXED_255;
-      if (im->has_alpha && alpha > FIXED_255) alpha = FIXED_255;
-
-      /*
-      DEBUG_TRACE("  -> %d, %d %x (%d %d %d %d)\n",
-        x, y, COL_FULL(fixed_to_int(red), fixed_to_int(green), fixed_to_int(blue), fixed_to_int(alpha)),
-        fixed_to_int(red), fixed_to_int(green), fixed_to_int(blue), fixed_to_int(alpha));
-      */
-
-      if (im->orientation != ORIENTATION_NORMAL) {
-        int ox, oy; // new destination pixel coordinates after rotating
-
-        image_get_rotated_coords(im, x, y, &ox, &oy);
-
-        if (im->orientation >= 5) {
-          // 90 and 270 rotations, width/height are swapped so we have to use alternate put_pix method
-          put_pix_rotated(
-            im, ox, oy, im->target_height,
-            COL_FULL(fixed_to_int(red), fixed_to_int(green), fixed_to_int(blue), fixed_to_int(alpha))
-          );
+        for ( ; i + 1 < n; i += 2) {
+          w1 = fixed_mul(xportion[i], yportion);
+          w2 = fixed_mul(xportion[i + 1], yportion);
+          GD_SSE41_MERGE2(acc, p + i, w1, w2);
+          spixels[x] += w1 + w2;
         }
-        else {
-          put_pix(
-            im, ox, oy,
-            COL_FULL(fixed_to_int(red), fixed_to_int(green), fixed_to_int(blue), fixed_to_int(alpha))
-          );
+
+        if (i < n) {
+          w1 = fixed_mul(xportion[i], yportion);
+          GD_SSE41_MERGE1(acc, p + i, w1);
+          spixels[x] += w1;
         }
+
+        _mm_storeu_si128(&sums[x], acc);
       }
-      else {
-        put_pix(
-          im, x, y,
-          COL_FULL(fixed_to_int(red), fixed_to_int(green), fixed_to_int(blue), fixed_to_int(alpha))
-        );
-      }
-	  }
-	}
+    }
+
+    for (x = 0; x < t->dstW; x++) {
+      int32_t s[4];
+
+      _mm_storeu_si128((__m128i *)s, _mm_loadu_si128(&sums[x]));
+
+      if ( !image_gd_fixed_finish_pix(im, &t->parts[part], x + t->dstX, y + t->dstY, s[3], s[2], s[1], s[0], spixels[x]) )
+        return;
+    }
+  }
 }
+#endif
@@ -29,25 +29,20 @@ image_gif_read_buf(GifFileType *gif, GifByteType *data, int len)
       warn("Image::Scale not enough GIF data (%s)\n", SvPVX(im->path));
       return 0;
     }
+
+    memcpy(data, buffer_ptr(im->buf), len);
+    buffer_consume(im->buf, len);
   }
   else {
-    if (len > buffer_len(im->buf)) {
-      // read from SV into buffer
-      int sv_readlen = len - buffer_len(im->buf);
-
-      if (sv_readlen > sv_len(im->sv_data) - im->sv_offset) {
-        warn("Image::Scale not enough GIF data (%s)\n", SvPVX(im->path));
-        return 0;
-      }
-
-      DEBUG_TRACE("  Reading %d bytes of SV data @ %d\n", sv_readlen, im->sv_offset);
-      buffer_append(im->buf, SvPVX(im->sv_data) + im->sv_offset, sv_readlen);
-      im->sv_offset += sv_readlen;
-     }
-  }
+    // Copy straight from the scalar or mapped file
+    if (len > image_data_len(im) - im->sv_offset) {
+      warn("Image::Scale not enough GIF data (%s)\n", SvPVX(im->path));
+      return 0;
+    }
 
-  memcpy(data, buffer_ptr(im->buf), len);
-  buffer_consume(im->buf, len);
+    memcpy(data, image_data_ptr(im) + im->sv_offset, len);
+    im->sv_offset += len;
+  }
 
   return len;
 }
@@ -55,6 +50,12 @@ image_gif_read_buf(GifFileType *gif, GifByteType *data, int len)
 int
 image_gif_read_header(image *im)
 {
+  if (im->fh == NULL) {
+    // Start over from the in-memory data, image_gif_read_buf() does not use the copy in im->buf
+    buffer_clear(im->buf);
+    im->sv_offset = im->image_offset;
+  }
+
 #ifdef GIFLIB_API_50
   im->gif = DGifOpen(im, image_gif_read_buf, NULL);
 #else
@@ -245,6 +246,12 @@ image_gif_load(image *im)
     }
   } while (RecordType != TERMINATE_RECORD_TYPE);
 
+  // Drop the alpha channel if the transparent color is never used, see image_png_load()
+  if (im->has_alpha && im->pixbuf != NULL && image_pix_opaque(im->pixbuf, im->width * im->height)) {
+    DEBUG_TRACE("GIF has no transparent pixels\n");
+    im->has_alpha = 0;
+  }
+
   return 1;
 }
 
@@ -16,6 +16,31 @@
 
 #include "image.h"
 #include "fixed.h"
+#include "magick.h"
+#include "pool.h"
+#include "simd.h"
+#include "stream.h"
+#include "writer.h"
+#include "probe.h"
+
+// Images in a scalar or a memory-mapped file are read in place, the length
+// option cuts the data short
+static unsigned char *
+image_data_ptr(image *im)
+{
+  return im->map != NULL ? im->map : (unsigned char *)SvPVX(im->sv_data);
+}
+
+static int
+image_data_len(image *im)
+{
+  int len = im->map != NULL ? (int)im->map_len : (int)sv_len(im->sv_data);
+
+  if (im->image_length && im->image_offset + im->image_length < len)
+    len = im->image_offset + im->image_length;
+
+  return len;
+}
 
 #include "bmp.c"
 #ifdef HAVE_JPEG
@@ -28,6 +53,9 @@
 #include "gif.c"
 #endif
 
+// Worker pool for the threads option
+#include "pool.c"
+
 // GD algorithm
 #include "gd.c"
 
@@ -35,6 +63,53 @@
 #include "magick.c"
 #include "magick_fixed.c"
 
+// Runtime selection of CPU-specific kernels
+#include "simd.c"
+
+// Resizing while decoding
+#include "stream.c"
+
+// Encoding while resizing
+#include "writer.c"
+
+// Header-only probing
+#include "probe.c"
+
+#ifdef HAVE_MMAP
+// Map the file so it can be read in place like a scalar, only up to the end of the
+// image if the length option was given.  Leaves im->fh to be read normally if the
+// file is small or can't be mapped, i.e. it is not a regular file
+static void
+image_map_file(image *im)
+{
+  off_t len = _file_size(im->fh);
+  void *map;
+
+  if (im->image_length && im->image_offset + im->image_length < len)
+    len = im->image_offset + im->image_length;
+
+  // Small images are read in one go anyway
+  if (len - im->image_offset <= BUFFER_SIZE || len > INT_MAX)
+    return;
+
+  map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, PerlIO_fileno(im->fh), 0);
+  if (map == MAP_FAILED) {
+    DEBUG_TRACE("Unable to mmap %s: %s\n", SvPVX(im->path), strerror(errno));
+    return;
+  }
+
+#ifdef MADV_SEQUENTIAL
+  madvise(map, len, MADV_SEQUENTIAL);
+#endif
+
+  DEBUG_TRACE("Mapped %d bytes of %s\n", (int)len, SvPVX(im->path));
+
+  im->map     = (unsigned char *)map;
+  im->map_len = len;
+  im->fh      = NULL;
+}
+#endif
+
 int
 image_init(HV *self, image *im)
 {
@@ -64,11 +139,15 @@ image_init(HV *self, image *im)
   im->outbuf           = NULL;
   im->outbuf_size      = 0;
   im->type             = UNKNOWN;
+  im->map              = NULL;
+  im->map_len          = 0;
   im->sv_offset        = 0;
   im->image_offset     = 0;
   im->image_length     = 0;
   im->width            = 0;
   im->height           = 0;
+  im->width_orig       = 0;
+  im->height_orig      = 0;
   im->width_padding    = 0;
   im->width_inner      = 0;
   im->height_padding   = 0;
@@ -83,14 +162,33 @@ image_init(HV *self, image *im)
   im->target_width     = 0;
   im->target_height    = 0;
   im->keep_aspect      = 0;
+  im->snap             = 0;
+  im->use_exif_thumbnail = 0;
   im->resize_type      = IMAGE_SCALE_TYPE_GD_FIXED;
   im->filter           = 0;
   im->bgcolor          = 0;
+  im->threads          = 0;
+  im->save_type        = UNKNOWN;
+  im->save_quality     = DEFAULT_JPEG_QUALITY;
+#ifdef HAVE_PNG
+  image_png_options_init(&im->save_png_options, NULL);
+#endif
+  im->save_dest        = NULL;
   im->used             = 0;
   im->palette          = NULL;
+  im->can_stream       = 0;
+  im->ring_rows        = 0;
+  im->stream           = NULL;
+  im->outbuf_rows      = 0;
+  im->writer           = NULL;
 
 #ifdef HAVE_JPEG
   im->cinfo            = NULL;
+  im->jpeg_coef_size   = 0;
+  im->exif_thumb_offset = 0;
+  im->exif_thumb_length = 0;
+  im->exif_thumb_width  = 0;
+  im->exif_thumb_height = 0;
 #endif
 #ifdef HAVE_PNG
   im->png_ptr          = NULL;
@@ -110,6 +208,12 @@ image_init(HV *self, image *im)
   if (my_hv_exists(self, "length"))
     im->image_length = SvIV(*(my_hv_fetch(self, "length")));
 
+#ifdef HAVE_MMAP
+  // Opt-in, a file that is truncated while it is mapped raises SIGBUS when read
+  if (im->fh != NULL && my_hv_exists(self, "mmap") && SvTRUE(*(my_hv_fetch(self, "mmap"))))
+    image_map_file(im);
+#endif
+
   Newz(0, im->buf, sizeof(Buffer), Buffer);
   buffer_init(im->buf, BUFFER_SIZE);
   im->memory_used = BUFFER_SIZE;
@@ -122,8 +226,16 @@ image_init(HV *self, image *im)
     }
   }
   else {
-    im->sv_offset = MIN(sv_len(im->sv_data) - im->image_offset, BUFFER_SIZE);
-    buffer_append(im->buf, SvPVX(im->sv_data) + im->image_offset, im->sv_offset);
+    int len = MIN(image_data_len(im) - im->image_offset, BUFFER_SIZE);
+
+    if (len < 8) {
+      // image_finish() releases im->path
+      image_finish(im);
+      croak("Unable to read image header for (data)\n");
+    }
+
+    buffer_append(im->buf, image_data_ptr(im) + im->image_offset, len);
+    im->sv_offset = im->image_offset + len;
   }
 
   bptr = buffer_ptr(im->buf);
@@ -208,6 +320,9 @@ image_init(HV *self, image *im)
 
   DEBUG_TRACE("Image dimenensions: %d x %d, channels %d\n", im->width, im->height, im->channels);
 
+  im->width_orig  = im->width;
+  im->height_orig = im->height;
+
 out:
   if (ret == 0)
     image_finish(im);
@@ -221,8 +336,9 @@ image_alloc(image *im, int width, int height)
   int size = width * height * sizeof(pix);
 
   if (im->memory_limit && im->memory_limit < im->memory_used + size) {
+    int wanted = im->memory_used + size;
     image_finish(im);
-    croak("Image::Scale memory_limit exceeded (wanted to allocate %d bytes)\n", im->memory_used + size);
+    croak("Image::Scale memory_limit exceeded (wanted to allocate %d bytes)\n", wanted);
   }
 
   DEBUG_TRACE("Allocating %d bytes for decompressed image\n", size);
@@ -246,81 +362,260 @@ image_bgcolor_fill(pix *buf, int size, int bgcolor)
   }
 }
 
+// Returns 1 if none of the count pixels are even partly transparent
 int
-image_resize(image *im)
+image_pix_opaque(pix *p, int count)
 {
-  int size;
-  int ret = 1;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (COL_ALPHA(p[i]) != 0xFF)
+      return 0;
+  }
+
+  return 1;
+}
+
+// Returns 1 if the source is grayscale, its pixels then have the same red, green
+// and blue so the resize only needs to work on one of them
+int
+image_gray_source(image *im)
+{
+  return im->channels == 1 || im->channels == 2;
+}
+
+// Returns 1 if the resized image can be saved as grayscale, a keep_aspect bgcolor
+// must be gray as well
+int
+image_gray_output(image *im)
+{
+  if ( !image_gray_source(im) )
+    return 0;
 
+  if (im->keep_aspect && im->bgcolor)
+    return COL_RED(im->bgcolor) == COL_BLUE(im->bgcolor) && COL_GREEN(im->bgcolor) == COL_BLUE(im->bgcolor);
+
+  return 1;
+}
+
+// Clears the options of an earlier resize so they don't carry over to the next one
+static void
+image_resize_reset(image *im)
+{
+  im->target_width  = 0;
+  im->target_height = 0;
+  im->keep_aspect   = 0;
+  im->snap          = 0;
+  im->use_exif_thumbnail = 0;
+  im->orientation   = im->orientation_orig;
+  im->bgcolor       = 0;
+  im->memory_limit  = 0;
+  im->resize_type   = IMAGE_SCALE_TYPE_GD;
+  im->filter        = 0;
+  im->threads       = 0;
+  im->save_type     = UNKNOWN;
+  im->save_quality  = DEFAULT_JPEG_QUALITY;
+
+  // The target is computed from the image's own size, not the size it (or a JPEG's
+  // thumbnail) was decoded at
+  im->width  = im->width_orig;
+  im->height = im->height_orig;
+}
+
+void
+image_resize_options(image *im, HV *opts)
+{
+  // Reset options if resize is being called multiple times
+  if (im->target_width)
+    image_resize_reset(im);
+
+  if (im->save_dest != NULL) {
+    SvREFCNT_dec(im->save_dest);
+    im->save_dest = NULL;
+  }
+
+  if (my_hv_exists(opts, "width"))
+    im->target_width = SvIV(*(my_hv_fetch(opts, "width")));
+
+  if (my_hv_exists(opts, "height"))
+    im->target_height = SvIV(*(my_hv_fetch(opts, "height")));
+
+  if (!im->target_width && !im->target_height) {
+    croak("Image::Scale->resize requires at least one of height or width");
+  }
+
+  if (my_hv_exists(opts, "keep_aspect"))
+    im->keep_aspect = SvIV(*(my_hv_fetch(opts, "keep_aspect")));
+
+  if (my_hv_exists(opts, "snap"))
+    im->snap = SvIV(*(my_hv_fetch(opts, "snap")));
+
+  if (my_hv_exists(opts, "use_exif_thumbnail"))
+    im->use_exif_thumbnail = SvIV(*(my_hv_fetch(opts, "use_exif_thumbnail")));
+
+  if (my_hv_exists(opts, "ignore_exif")) {
+    if (SvIV(*(my_hv_fetch(opts, "ignore_exif"))) != 0)
+      im->orientation = ORIENTATION_NORMAL;
+  }
+
+  if (my_hv_exists(opts, "bgcolor"))
+    im->bgcolor = SvIV(*(my_hv_fetch(opts, "bgcolor"))) << 8 | 0xFF;
+
+  if (my_hv_exists(opts, "memory_limit"))
+    im->memory_limit = SvIV(*(my_hv_fetch(opts, "memory_limit")));
+
+  if (my_hv_exists(opts, "threads"))
+    im->threads = SvIV(*(my_hv_fetch(opts, "threads")));
+
+  if (my_hv_exists(opts, "type"))
+    im->resize_type = SvIV(*(my_hv_fetch(opts, "type")));
+
+  if (my_hv_exists(opts, "save_jpeg")) {
+#ifdef HAVE_JPEG
+    im->save_type = JPEG;
+    im->save_dest = newSVsv(*(my_hv_fetch(opts, "save_jpeg")));
+#else
+    croak("Image::Scale was not built with JPEG support\n");
+#endif
+  }
+  else if (my_hv_exists(opts, "save_png")) {
+#ifdef HAVE_PNG
+    im->save_type = PNG;
+    im->save_dest = newSVsv(*(my_hv_fetch(opts, "save_png")));
+#else
+    croak("Image::Scale was not built with PNG support\n");
+#endif
+  }
+
+  if (my_hv_exists(opts, "quality"))
+    im->save_quality = SvIV(*(my_hv_fetch(opts, "quality")));
+
+#ifdef HAVE_PNG
+  // Not named filter, which is the resize filter
+  if (my_hv_exists(opts, "png_options")) {
+    SV *png_opts = *(my_hv_fetch(opts, "png_options"));
+    if ( !SvROK(png_opts) || SvTYPE(SvRV(png_opts)) != SVt_PVHV )
+      croak("Image::Scale png_options must be a hashref");
+    image_png_options_init(&im->save_png_options, (HV *)SvRV(png_opts));
+  }
+  else {
+    image_png_options_init(&im->save_png_options, NULL);
+  }
+#endif
+
+  if (my_hv_exists(opts, "filter")) {
+    char *filterstr = SvPVX(*(my_hv_fetch(opts, "filter")));
+    if (strEQ("Point", filterstr))
+      im->filter = PointFilter;
+    else if (strEQ("Box", filterstr))
+      im->filter = BoxFilter;
+    else if (strEQ("Triangle", filterstr))
+      im->filter = TriangleFilter;
+    else if (strEQ("Hermite", filterstr))
+      im->filter = HermiteFilter;
+    else if (strEQ("Hanning", filterstr))
+      im->filter = HanningFilter;
+    else if (strEQ("Hamming", filterstr))
+      im->filter = HammingFilter;
+    else if (strEQ("Blackman", filterstr))
+      im->filter = BlackmanFilter;
+    else if (strEQ("Gaussian", filterstr))
+      im->filter = GaussianFilter;
+    else if (strEQ("Quadratic", filterstr))
+      im->filter = QuadraticFilter;
+    else if (strEQ("Cubic", filterstr))
+      im->filter = CubicFilter;
+    else if (strEQ("Catrom", filterstr))
+      im->filter = CatromFilter;
+    else if (strEQ("Mitchell", filterstr))
+      im->filter = MitchellFilter;
+    else if (strEQ("Lanczos", filterstr))
+      im->filter = LanczosFilter;
+    else if (strEQ("Bessel", filterstr))
+      im->filter = BesselFilter;
+    else if (strEQ("Sinc", filterstr))
+      im->filter = SincFilter;
+  }
+
+  // If the image will be rotated 90 degrees, swap the target values
+  if (im->orientation >= 5) {
+    if (!im->target_height) {
+      // Only width was specified, but this will actually be the target height
+      im->target_height = im->target_width;
+      im->target_width = 0;
+    }
+    else if (!im->target_width) {
+      // Only height was specified, but this will actually be the target width
+      im->target_width = im->target_height;
+      im->target_height = 0;
+    }
+  }
+
+  if (!im->target_height) {
+    // Only width was specified
+    im->target_height = (int)((float)im->height / im->width * im->target_width);
+    if (im->target_height < 1)
+      im->target_height = 1;
+  }
+  else if (!im->target_width) {
+    // Only height was specified
+    im->target_width = (int)((float)im->width / im->height * im->target_height);
+    if (im->target_width < 1)
+      im->target_width = 1;
+  }
+
+  DEBUG_TRACE("Resizing from %d x %d -> %d x %d\n", im->width, im->height, im->target_width, im->target_height);
+}
+
+static int
+image_load(image *im)
+{
   // Check if we have already resized an image with this object,
   // if so, clear everything we've already done
   if (im->used) {
     DEBUG_TRACE("Object already used for a resize, resetting\n");
-    if (im->outbuf != NULL) {
-      Safefree(im->outbuf);
-      im->outbuf = NULL;
-      im->memory_used -= im->outbuf_size;
-    }
+    image_outbuf_free(im);
 
-#ifdef HAVE_JPEG
-    // For a JPEG we have to reset the scaled size in case we're resizing larger than before
-    if (im->type == JPEG) {
-      im->width = im->cinfo->image_width;
-      im->height = im->cinfo->image_height;
+    // JPEG and PNG may have been decoded at a reduced size, reset it in case we're
+    // resizing larger than before
+    im->width  = im->width_orig;
+    im->height = im->height_orig;
 
-      DEBUG_TRACE("JPEG dimensions set back to original %d x %d\n", im->width, im->height);
-    }
-#endif
+    DEBUG_TRACE("Dimensions set back to original %d x %d\n", im->width, im->height);
   }
 
   // Load the source image into memory
   switch (im->type) {
 #ifdef HAVE_JPEG
     case JPEG:
-      if ( !image_jpeg_load(im) ) {
-        ret = 0;
-        goto out;
-      }
-      break;
+      return image_jpeg_load(im);
 #endif
 #ifdef HAVE_PNG
     case PNG:
-      if ( !image_png_load(im) ) {
-        ret = 0;
-        goto out;
-      }
-      break;
+      return image_png_load(im);
 #endif
 #ifdef HAVE_GIF
     case GIF:
-      if ( !image_gif_load(im) ) {
-        ret = 0;
-        goto out;
-      }
-      break;
+      return image_gif_load(im);
 #endif
     case BMP:
-      if ( !image_bmp_load(im) ) {
-        ret = 0;
-        goto out;
-      }
-      break;
+      return image_bmp_load(im);
   }
 
-  // Special case for equal size without resizing
-  if (im->width == im->target_width && im->height == im->target_height) {
-    im->outbuf = im->pixbuf;
-    goto out;
-  }
+  return 1;
+}
 
-  // Allocate space for the resized image
-  size = im->target_width * im->target_height;
-  im->outbuf_size = size * sizeof(pix);
+// Allocate im->outbuf for the resized image (or a band of outbuf_rows) and fill in any keep_aspect padding.
+// Returns 0 without allocating anything if this would exceed the memory_limit
+int
+image_outbuf_alloc(image *im)
+{
+  int size = im->target_width * (im->outbuf_rows ? im->outbuf_rows : im->target_height);
 
-  if (im->memory_limit && im->memory_limit < im->memory_used + im->outbuf_size) {
-    image_finish(im);
-    croak("Image::Scale memory_limit exceeded (wanted to allocate %d bytes)\n", im->memory_used + im->outbuf_size);
-  }
+  if (im->memory_limit && im->memory_limit < im->memory_used + size * (int)sizeof(pix))
+    return 0;
+
+  im->outbuf_size = size * sizeof(pix);
 
   DEBUG_TRACE("Allocating %d bytes for resized image of size %d x %d\n",
     im->outbuf_size, im->target_width, im->target_height);
@@ -352,6 +647,43 @@ image_resize(image *im)
       im->width_padding, im->width_inner, im->height_padding, im->height_inner, im->bgcolor);
   }
 
+  return 1;
+}
+
+// If the image was rotated, swap the width/height if necessary
+// This is needed for the save_*() functions to output the correct size
+void
+image_outbuf_rotated(image *im)
+{
+  if (im->orientation >= 5) {
+    int tmp = im->target_height;
+    im->target_height = im->target_width;
+    im->target_width = tmp;
+
+    DEBUG_TRACE("Image was rotated, output now %d x %d\n", im->target_width, im->target_height);
+  }
+}
+
+void
+image_outbuf_free(image *im)
+{
+  if (im->outbuf != NULL) {
+    Safefree(im->outbuf);
+    im->outbuf = NULL;
+    im->memory_used -= im->outbuf_size;
+  }
+
+  im->outbuf_rows = 0;
+}
+
+// Resize im->pixbuf into a newly allocated im->outbuf.  Returns 0 without
+// allocating anything if this would exceed the memory_limit
+static int
+image_downsize(image *im)
+{
+  if ( !image_outbuf_alloc(im) )
+    return 0;
+
   // Resize
   switch (im->resize_type) {
     case IMAGE_SCALE_TYPE_GD:
@@ -371,26 +703,248 @@ image_resize(image *im)
       croak("Image::Scale unknown resize type %d\n", im->resize_type);
   }
 
-  // If the image was rotated, swap the width/height if necessary
-  // This is needed for the save_*() functions to output the correct size
-  if (im->orientation >= 5) {
-    int tmp = im->target_height;
-    im->target_height = im->target_width;
-    im->target_width = tmp;
+  image_outbuf_rotated(im);
 
-    DEBUG_TRACE("Image was rotated, output now %d x %d\n", im->target_width, im->target_height);
+  return 1;
+}
+
+int
+image_resize(image *im)
+{
+  int ret = 1;
+
+  // Pick the kernels for this CPU the first time a resize is done
+  if (simd == NULL)
+    image_simd_init();
+
+  if (im->save_type)
+    image_writer_open(im);
+
+  // The gd resizers can run while the image is decoded, see image_alloc_rows()
+  im->can_stream = (im->resize_type == IMAGE_SCALE_TYPE_GD || im->resize_type == IMAGE_SCALE_TYPE_GD_FIXED);
+
+  if ( !image_load(im) ) {
+    image_stream_free(im);
+    image_writer_free(im);
+    ret = 0;
+    goto out;
+  }
+
+  if (im->stream != NULL) {
+    // Produce the rows that were waiting for the end of the image
+    image_stream_finish(im);
+  }
+  else if (im->width == im->target_width && im->height == im->target_height) {
+    // Special case for equal size without resizing
+    im->outbuf = im->pixbuf;
+    im->pixbuf = NULL;
+  }
+  else if ( !image_downsize(im) ) {
+    int wanted = im->memory_used + im->target_width * im->target_height * sizeof(pix);
+    image_finish(im);
+    croak("Image::Scale memory_limit exceeded (wanted to allocate %d bytes)\n", wanted);
   }
 
   // After resizing we can release the source image memory
   Safefree(im->pixbuf);
   im->pixbuf = NULL;
 
+  if (im->writer != NULL) {
+    // The resized image has been saved, and is not kept
+    image_writer_close(im);
+    image_outbuf_free(im);
+  }
+
 out:
+  im->can_stream = 0;
   im->used++;
 
   return ret;
 }
 
+void
+image_init_resized(image *im, image *out)
+{
+  // out only ever holds a resized copy of im, so it has no file or decoder state
+  Zero(out, 1, image);
+
+  out->type             = UNKNOWN;
+  out->path             = newSVsv(im->path);
+  // Not im->width, which is the decoded size if an earlier resize pre-scaled a JPEG
+  out->width            = im->width_orig;
+  out->height           = im->height_orig;
+  out->width_orig       = im->width_orig;
+  out->height_orig      = im->height_orig;
+  out->channels         = im->channels;
+  out->has_alpha        = im->has_alpha;
+  out->orientation      = im->orientation_orig;
+  out->orientation_orig = im->orientation_orig;
+  out->resize_type      = IMAGE_SCALE_TYPE_GD_FIXED;
+  out->save_quality     = DEFAULT_JPEG_QUALITY;
+}
+
+int
+image_resize_multi(image *im, image **outs, int count)
+{
+  int *order;
+  int *orientation;
+  int i, j, k;
+  int ret = 1;
+
+  if (simd == NULL)
+    image_simd_init();
+
+  // Only the sizes' own options apply, not those of an earlier resize() of im
+  image_resize_reset(im);
+
+  // Decode once, large enough for every size (JPEG may be pre-scaled on load),
+  // the decode is only limited if every size has a memory_limit
+  im->memory_limit  = outs[0]->memory_limit;
+  for (i = 0; i < count; i++) {
+    if (outs[i]->resize_type < IMAGE_SCALE_TYPE_GD || outs[i]->resize_type > IMAGE_SCALE_TYPE_GM_FIXED)
+      croak("Image::Scale unknown resize type %d\n", outs[i]->resize_type);
+
+    im->target_width  = MAX(im->target_width, outs[i]->target_width);
+    im->target_height = MAX(im->target_height, outs[i]->target_height);
+    if (!outs[i]->memory_limit || !im->memory_limit)
+      im->memory_limit = 0;
+    else
+      im->memory_limit = MAX(im->memory_limit, outs[i]->memory_limit);
+  }
+
+  for (i = 0; i < count; i++) {
+    if (outs[i]->save_type)
+      image_writer_open(outs[i]);
+  }
+
+  if ( !image_load(im) ) {
+    for (i = 0; i < count; i++)
+      image_writer_free(outs[i]);
+    ret = 0;
+    goto out;
+  }
+
+  // Resize the largest sizes first, so each smaller one can be produced from a
+  // larger result instead of the full source image
+  New(0, order, count, int);
+  New(0, orientation, count, int);
+  for (i = 0; i < count; i++) {
+    for (j = i; j > 0; j--) {
+      image *prev = outs[order[j - 1]];
+      if (prev->target_width * prev->target_height >= outs[i]->target_width * outs[i]->target_height)
+        break;
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+    orientation[i] = outs[i]->orientation;
+  }
+
+  for (i = 0; i < count; i++) {
+    image *out = outs[order[i]];
+    image *src = NULL;
+    int width  = out->target_width;
+    int height = out->target_height;
+
+    // Size of this output after any rotation
+    if (out->orientation >= 5) {
+      width  = out->target_height;
+      height = out->target_width;
+    }
+
+    // Use the smallest finished output that is at least IMAGE_MULTI_MIN_SCALE times
+    // larger, with the same rotation and no padding to throw off the aspect ratio
+    for (j = 0; j < i; j++) {
+      image *cand = outs[order[j]];
+
+      if (orientation[order[j]] != out->orientation || cand->width_padding || cand->height_padding)
+        continue;
+
+      if (cand->target_width < width * IMAGE_MULTI_MIN_SCALE || cand->target_height < height * IMAGE_MULTI_MIN_SCALE)
+        continue;
+
+      if (src == NULL || cand->target_width * cand->target_height < src->target_width * src->target_height)
+        src = cand;
+    }
+
+    if (src != NULL) {
+      DEBUG_TRACE("Resizing %d x %d from earlier %d x %d output\n", width, height, src->target_width, src->target_height);
+      out->pixbuf        = src->outbuf;
+      out->width         = src->target_width;
+      out->height        = src->target_height;
+      out->target_width  = width;
+      out->target_height = height;
+      out->orientation   = ORIENTATION_NORMAL;
+    }
+    else {
+      out->pixbuf = im->pixbuf;
+      out->width  = im->width;
+      out->height = im->height;
+    }
+    out->channels    = im->channels;
+    out->has_alpha   = im->has_alpha;
+    out->memory_used = im->memory_used;
+    for (k = 0; k < i; k++)
+      out->memory_used += outs[order[k]]->outbuf_size;
+
+    if (out->width == out->target_width && out->height == out->target_height && out->orientation == ORIENTATION_NORMAL) {
+      // Same size, just copy
+      out->outbuf_size = out->width * out->height * sizeof(pix);
+      if (out->memory_limit && out->memory_limit < out->memory_used + out->outbuf_size) {
+        out->pixbuf = NULL;
+        goto memory_limit;
+      }
+      New(0, out->outbuf, out->width * out->height, pix);
+      Copy(out->pixbuf, out->outbuf, out->width * out->height, pix);
+      out->memory_used += out->outbuf_size;
+    }
+    else if ( !image_downsize(out) ) {
+      out->pixbuf = NULL;
+      goto memory_limit;
+    }
+
+    // The source belongs to im or to another output
+    out->pixbuf = NULL;
+    out->used++;
+  }
+
+  Safefree(order);
+  Safefree(orientation);
+
+  // After resizing we can release the source image memory
+  Safefree(im->pixbuf);
+  im->pixbuf = NULL;
+
+  // Saved sizes are not kept, they were only needed as the source of smaller ones
+  for (i = 0; i < count; i++) {
+    if (outs[i]->writer != NULL) {
+      image_writer_close(outs[i]);
+      image_outbuf_free(outs[i]);
+    }
+  }
+
+out:
+  im->used++;
+
+  return ret;
+
+memory_limit:
+  {
+    image *out = outs[order[i]];
+    int wanted = out->memory_used + out->target_width * out->target_height * sizeof(pix);
+
+    for (i = 0; i < count; i++)
+      image_writer_free(outs[i]);
+
+    Safefree(order);
+    Safefree(orientation);
+    Safefree(im->pixbuf);
+    im->pixbuf = NULL;
+    im->used++;
+
+    croak("Image::Scale memory_limit exceeded (wanted to allocate %d bytes)\n", wanted);
+  }
+}
+
 void
 image_finish(image *im)
 {
@@ -420,12 +974,27 @@ image_finish(image *im)
       break;
   }
 
+  image_stream_free(im);
+  image_writer_free(im);
+
+  if (im->save_dest != NULL) {
+    SvREFCNT_dec(im->save_dest);
+    im->save_dest = NULL;
+  }
+
   if (im->buf != NULL) {
     buffer_free(im->buf);
     Safefree(im->buf);
     im->buf = NULL;
   }
 
+#ifdef HAVE_MMAP
+  if (im->map != NULL) {
+    munmap(im->map, im->map_len);
+    im->map = NULL;
+  }
+#endif
+
   if (im->pixbuf != NULL && im->pixbuf != im->outbuf) { // pixbuf = outbuf if resizing to same dimensions
     Safefree(im->pixbuf);
     im->pixbuf = NULL;
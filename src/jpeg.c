@@ -17,10 +17,21 @@
 #define LE 0     // Exif byte orders
 #define BE 1
 
-// Force JCS_EXTENSIONS to off for non-x86 platforms, the way we build our
-// i386+ppc OSX binary needs this
-#ifndef __i386__
-# undef JCS_EXTENSIONS
+// pix is a native uint32_t of R << 24 | G << 16 | B << 8 | A, libjpeg-turbo can
+// read and write it directly using the extended color space with the same byte
+// order.  Decoding uses the alpha version so the alpha byte is set to 0xFF
+#ifdef JCS_EXTENSIONS
+# if BYTEORDER == 0x1234 || BYTEORDER == 0x12345678
+#  define JCS_PIX_IN JCS_EXT_XBGR
+#  ifdef JCS_ALPHA_EXTENSIONS
+#   define JCS_PIX_OUT JCS_EXT_ABGR
+#  endif
+# elif BYTEORDER == 0x4321 || BYTEORDER == 0x87654321
+#  define JCS_PIX_IN JCS_EXT_RGBX
+#  ifdef JCS_ALPHA_EXTENSIONS
+#   define JCS_PIX_OUT JCS_EXT_RGBA
+#  endif
+# endif
 #endif
 
 // Unfortunately we need a global variable in order to display the filename
@@ -38,6 +49,7 @@ struct sv_dst_mgr {
 typedef struct buf_src_mgr {
   struct jpeg_source_mgr jsrc;
   image *im;
+  int thumbnail; // im->buf holds the whole EXIF thumbnail, see image_jpeg_use_thumbnail()
 } buf_src_mgr;
 
 // Source manager to read JPEG from buffer
@@ -59,22 +71,28 @@ buf_src_fill_input_buffer(j_decompress_ptr cinfo)
   // Consume the entire buffer, even if bytes are still in bytes_in_buffer
   buffer_consume(im->buf, buffer_len(im->buf));
 
-  if (im->fh != NULL) {
+  if (src->thumbnail) {
+    goto eof;
+  }
+  else if (im->fh != NULL) {
     if ( !_check_buf(im->fh, im->buf, 1, BUFFER_SIZE) ) {
       goto eof;
     }
   }
   else {
-    // read from SV into buffer
-    int sv_readlen = MIN(sv_len(im->sv_data) - im->sv_offset, BUFFER_SIZE);
+    // Decode in place from the scalar or mapped file, the rest of the data is given to libjpeg in one span
+    int sv_readlen = image_data_len(im) - im->sv_offset;
 
     // corrupt JPEGs read from SV buffers need to check for EOF
     if (sv_readlen <= 0)
       goto eof;
 
-    DEBUG_TRACE("  Reading %d bytes of SV data @ %d\n", sv_readlen, im->sv_offset);
-    buffer_append(im->buf, SvPVX(im->sv_data) + im->sv_offset, sv_readlen);
+    DEBUG_TRACE("  Using %d bytes of SV data @ %d\n", sv_readlen, im->sv_offset);
+    cinfo->src->next_input_byte = (JOCTET *)image_data_ptr(im) + im->sv_offset;
+    cinfo->src->bytes_in_buffer = sv_readlen;
     im->sv_offset += sv_readlen;
+
+    goto ok;
   }
 
   cinfo->src->next_input_byte = (JOCTET *)buffer_ptr(im->buf);
@@ -99,9 +117,6 @@ ok:
 static void
 buf_src_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
 {
-  buf_src_mgr *src = (buf_src_mgr *)cinfo->src;
-  image *im = src->im;
-
   if (num_bytes > 0) {
     DEBUG_TRACE("JPEG skip requested: num_bytes=%ld, src->bytes_in_buffer=%ld\n", num_bytes, cinfo->src->bytes_in_buffer);
 
@@ -114,12 +129,9 @@ buf_src_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
       DEBUG_TRACE("After fill_input_buffer, num_bytes=%ld bytes, src->bytes_in_buffer=%ld\n", num_bytes, cinfo->src->bytes_in_buffer);
     }
 
-    // Discard the remaining bytes, taking into account the amount libjpeg has already read
-    DEBUG_TRACE("  JPEG buffer consume %ld bytes\n", (buffer_len(im->buf) - cinfo->src->bytes_in_buffer) + num_bytes);
-    buffer_consume(im->buf, (buffer_len(im->buf) - cinfo->src->bytes_in_buffer) + num_bytes);
-
-    cinfo->src->next_input_byte = (JOCTET *)buffer_ptr(im->buf);
-    cinfo->src->bytes_in_buffer = buffer_len(im->buf);
+    // The rest is within the current span, which may be im->buf or the SV data
+    cinfo->src->next_input_byte += num_bytes;
+    cinfo->src->bytes_in_buffer -= num_bytes;
   }
 }
 
@@ -143,6 +155,7 @@ image_jpeg_buf_src(image *im)
   src = (buf_src_mgr *)cinfo->src;
 
   src->im = im;
+  src->thumbnail = 0;
 
   src->jsrc.init_source       = buf_src_init;
   src->jsrc.fill_input_buffer = buf_src_fill_input_buffer;
@@ -152,6 +165,13 @@ image_jpeg_buf_src(image *im)
   src->jsrc.bytes_in_buffer   = buffer_len(im->buf);
   src->jsrc.next_input_byte   = (JOCTET *)buffer_ptr(im->buf);
 
+  if (im->fh == NULL) {
+    // Start over from the in-memory data, fill_input_buffer uses it in place of the copy in im->buf
+    buffer_clear(im->buf);
+    im->sv_offset = im->image_offset;
+    src->jsrc.bytes_in_buffer = 0;
+  }
+
   DEBUG_TRACE("Init JPEG buffer src, %d bytes in buffer\n", buffer_len(im->buf));
 }
 
@@ -213,36 +233,144 @@ image_jpeg_sv_dest(j_compress_ptr cinfo, struct sv_dst_mgr *dst, SV *sv_buf)
   cinfo->dest = (void *)dst;
 }
 
+// Returns the dimensions of a JPEG in memory from its SOF marker
+static int
+image_jpeg_size(const unsigned char *data, int len, int *width, int *height)
+{
+  int i = 2;
+
+  if (len < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    return 0;
+
+  while (i + 4 <= len && data[i] == 0xFF) {
+    int marker = data[i + 1];
+
+    if (marker == 0xFF) { // fill byte
+      i++;
+      continue;
+    }
+
+    if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) { // SOF, only ones libjpeg can always decode
+      if (i + 9 > len)
+        return 0;
+
+      *height = data[i + 5] << 8 | data[i + 6];
+      *width  = data[i + 7] << 8 | data[i + 8];
+      return *width > 0 && *height > 0;
+    }
+
+    if (marker == 0xDA || marker == 0xD9) // SOS or EOI before any supported SOF
+      return 0;
+
+    i += 2 + (data[i + 2] << 8 | data[i + 3]);
+  }
+
+  return 0;
+}
+
+static jpeg_saved_marker_ptr
+image_jpeg_exif_marker(struct jpeg_decompress_struct *cinfo)
+{
+  jpeg_saved_marker_ptr marker = cinfo->marker_list;
+
+  while (marker != NULL) {
+    DEBUG_TRACE("Found marker: %x len %d\n", marker->marker, marker->data_length);
+
+    if (marker->marker == 0xE1 && marker->data_length >= 14
+      && marker->data[0] == 'E' && marker->data[1] == 'x'
+      && marker->data[2] == 'i' && marker->data[3] == 'f'
+    ) {
+      return marker;
+    }
+
+    marker = marker->next;
+  }
+
+  return NULL;
+}
+
+// Reads the orientation from IFD0 and the location of the JPEG thumbnail from IFD1
 static void
-image_jpeg_parse_exif_orientation(image *im, Buffer *exif)
+image_jpeg_parse_exif(image *im, jpeg_saved_marker_ptr marker)
 {
-  int bo, offset, num_entries;
+  Buffer exif;
+  int bo, offset, num_entries, tiff_len;
+  int thumb_offset = 0, thumb_length = 0;
+
+  buffer_init(&exif, marker->data_length);
+  buffer_append(&exif, marker->data, marker->data_length);
 
-  buffer_consume(exif, 6); // Exif\0\0
-  bo = (buffer_get_short(exif) == 0x4949) ? LE : BE;
+  buffer_consume(&exif, 6); // Exif\0\0
+  tiff_len = buffer_len(&exif);
+  bo = (buffer_get_short(&exif) == 0x4949) ? LE : BE;
 
-  buffer_consume(exif, 2); // 0x2a00
+  buffer_consume(&exif, 2); // 0x2a00
 
-  offset = (bo == LE) ? buffer_get_int_le(exif) : buffer_get_int(exif);
-  buffer_consume(exif, offset - 8); // skip to offset (from the start of the byte order)
+  offset = (bo == LE) ? buffer_get_int_le(&exif) : buffer_get_int(&exif);
+  buffer_consume(&exif, offset - 8); // skip to offset (from the start of the byte order)
 
-  num_entries = (bo == LE) ? buffer_get_short_le(exif) : buffer_get_short(exif);
+  num_entries = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
 
-  // All we care about is the orientation
-  while (num_entries--) {
-    int type_id = (bo == LE) ? buffer_get_short_le(exif) : buffer_get_short(exif);
+  while (num_entries-- && buffer_len(&exif) >= 12) {
+    int type_id = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
 
     if (type_id == 0x112) {
-      buffer_consume(exif, 6);
-      im->orientation = (bo == LE) ? buffer_get_short_le(exif) : buffer_get_short(exif);
+      buffer_consume(&exif, 6);
+      im->orientation = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
+      buffer_consume(&exif, 2);
 
       DEBUG_TRACE("Exif Orientation: %d\n", im->orientation);
-      break;
+      continue;
+    }
+
+    buffer_consume(&exif, 10);
+  }
+
+  // Offset of IFD1, which describes the thumbnail
+  if (num_entries < 0 && buffer_len(&exif) >= 4) {
+    int pos;
+
+    offset = (bo == LE) ? buffer_get_int_le(&exif) : buffer_get_int(&exif);
+    pos = tiff_len - buffer_len(&exif);
+
+    if (offset >= pos && offset + 2 <= tiff_len) {
+      buffer_consume(&exif, offset - pos);
+      num_entries = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
+
+      while (num_entries-- && buffer_len(&exif) >= 12) {
+        int type_id = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
+        int type    = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
+        int value;
+
+        buffer_consume(&exif, 4); // count
+
+        if (type == 3) { // SHORT
+          value = (bo == LE) ? buffer_get_short_le(&exif) : buffer_get_short(&exif);
+          buffer_consume(&exif, 2);
+        }
+        else {
+          value = (bo == LE) ? buffer_get_int_le(&exif) : buffer_get_int(&exif);
+        }
+
+        if (type_id == 0x201)
+          thumb_offset = value;
+        else if (type_id == 0x202)
+          thumb_length = value;
+      }
     }
+  }
 
-    buffer_consume(exif, 10);
+  if (thumb_offset > 0 && thumb_length > 0 && thumb_offset <= tiff_len - thumb_length
+    && image_jpeg_size(marker->data + 6 + thumb_offset, thumb_length, &im->exif_thumb_width, &im->exif_thumb_height)
+  ) {
+    im->exif_thumb_offset = 6 + thumb_offset;
+    im->exif_thumb_length = thumb_length;
+
+    DEBUG_TRACE("Exif thumbnail: %d x %d, %d bytes\n", im->exif_thumb_width, im->exif_thumb_height, thumb_length);
   }
 
+  buffer_free(&exif);
+
   // Save original orientation in case it is changed by ignore_exif
   im->orientation_orig = im->orientation;
 }
@@ -251,7 +379,9 @@ jmp_buf setjmp_buffer;
 static void
 libjpeg_error_handler(j_common_ptr cinfo)
 {
-  cinfo->err->output_message(cinfo);
+  // Going over the memory_limit is reported by image_jpeg_load(), see image_jpeg_memory_limit()
+  if (cinfo->err->msg_code != JERR_NO_BACKING_STORE)
+    cinfo->err->output_message(cinfo);
   longjmp(setjmp_buffer, 1);
   return;
 }
@@ -308,40 +438,181 @@ image_jpeg_read_header(image *im)
   im->height   = im->cinfo->image_height;
   im->channels = im->cinfo->num_components;
 
-  // Process Exif looking for orientation tag
+  // Process Exif looking for orientation tag and thumbnail
   if (im->cinfo->marker_list != NULL) {
-    jpeg_saved_marker_ptr marker = im->cinfo->marker_list;
+    jpeg_saved_marker_ptr marker = image_jpeg_exif_marker(im->cinfo);
+
+    if (marker != NULL)
+      image_jpeg_parse_exif(im, marker);
+  }
 
-    while (marker != NULL) {
-      DEBUG_TRACE("Found marker: %x len %d\n", marker->marker, marker->data_length);
+  return 1;
+}
 
-      if (marker->marker == 0xE1
-        && marker->data[0] == 'E' && marker->data[1] == 'x'
-        && marker->data[2] == 'i' && marker->data[3] == 'f'
-      ) {
-        Buffer exif;
+// For the use_exif_thumbnail option, if the EXIF thumbnail is at least the target size and
+// has the same aspect ratio (some cameras add black bars to it), read its header in place
+// of the main image's, so it is decoded instead.  Returns 0 if the thumbnail can't be used
+static int
+image_jpeg_use_thumbnail(image *im)
+{
+  jpeg_saved_marker_ptr marker;
+  double width  = im->cinfo->image_width;
+  double height = im->cinfo->image_height;
+  double error  = fabs(im->exif_thumb_width * height - im->exif_thumb_height * width); // allow 1 thumbnail pixel
+
+  if ( !im->exif_thumb_length
+    || im->target_width > im->exif_thumb_width || im->target_height > im->exif_thumb_height
+    || error > width || error > height )
+    return 0;
 
-        buffer_init(&exif, marker->data_length);
-        buffer_append(&exif, marker->data, marker->data_length);
+  marker = image_jpeg_exif_marker(im->cinfo);
+  if (marker == NULL || marker->data_length < im->exif_thumb_offset + im->exif_thumb_length)
+    return 0;
 
-        image_jpeg_parse_exif_orientation(im, &exif);
+  // The marker data is freed by jpeg_abort_decompress(), so decode from a copy in the
+  // source buffer, fill_input_buffer will not read any more after it
+  buffer_clear(im->buf);
+  buffer_append(im->buf, marker->data + im->exif_thumb_offset, im->exif_thumb_length);
 
-        buffer_free(&exif);
-        break;
-      }
+  jpeg_abort_decompress(im->cinfo);
+
+  ((buf_src_mgr *)im->cinfo->src)->thumbnail = 1;
+  im->cinfo->src->next_input_byte = (JOCTET *)buffer_ptr(im->buf);
+  im->cinfo->src->bytes_in_buffer = buffer_len(im->buf);
+
+  jpeg_read_header(im->cinfo, TRUE);
+
+  return 1;
+}
+
+// For the snap option, if a DCT scaled size is within im->snap pixels of the target
+// use that scale and make it the target, so the image needs no resampling at all.
+// Not used when the image will be padded or rotated as that needs a resize anyway.
+// Returns 0 with the scale reset to 1/1 if no size is close enough
+static int
+image_jpeg_snap(image *im)
+{
+  unsigned int scale_num, best = 0;
+  int diff, best_diff = im->snap;
+
+  if (im->keep_aspect || im->orientation != ORIENTATION_NORMAL)
+    return 0;
+
+  for (scale_num = 1; scale_num <= 8; scale_num++) {
+    im->cinfo->scale_num   = scale_num;
+    im->cinfo->scale_denom = 8;
+    jpeg_calc_output_dimensions(im->cinfo);
 
-      marker = marker->next;
+    diff = MAX( abs((int)im->cinfo->output_width - im->target_width), abs((int)im->cinfo->output_height - im->target_height) );
+    if (diff <= best_diff) { // prefer the larger size when equally close
+      best      = scale_num;
+      best_diff = diff;
     }
   }
 
+  im->cinfo->scale_num   = best ? best : 1;
+  im->cinfo->scale_denom = best ? 8 : 1;
+  jpeg_calc_output_dimensions(im->cinfo);
+
+  if (!best)
+    return 0;
+
+  im->target_width  = im->cinfo->output_width;
+  im->target_height = im->cinfo->output_height;
+
+  return 1;
+}
+
+// At 1/8 scale every output pixel is the average of a block, which only depends on the DC
+// coefficients (and for subsampled color, a few AC coefficients).  Progressive JPEGs send
+// all of the DC coefficients before most of the AC data, so for these the input is only
+// read until the DC coefficients are complete, then that scan is output as the image
+static int
+image_jpeg_dc_complete(struct jpeg_decompress_struct *cinfo)
+{
+  int c;
+
+  for (c = 0; c < cinfo->num_components; c++) {
+    if (cinfo->coef_bits[c][0] != 0)
+      return 0;
+  }
+
   return 1;
 }
 
+static void
+image_jpeg_start_dc_output(image *im)
+{
+  int ret;
+
+  while ( (ret = jpeg_consume_input(im->cinfo)) != JPEG_REACHED_EOI && ret != JPEG_SUSPENDED ) {
+    if ( ret == JPEG_SCAN_COMPLETED && image_jpeg_dc_complete(im->cinfo) )
+      break;
+  }
+
+  DEBUG_TRACE("Decoding progressive JPEG up to scan %d\n", im->cinfo->input_scan_number);
+
+  jpeg_start_output(im->cinfo, im->cinfo->input_scan_number);
+}
+
+// Done with output, in buffered-image mode the rest of the input is not read
+static void
+image_jpeg_finish_output(image *im)
+{
+  if (im->cinfo->buffered_image) {
+    jpeg_finish_output(im->cinfo);
+    jpeg_abort_decompress(im->cinfo);
+  }
+  else {
+    jpeg_finish_decompress(im->cinfo);
+  }
+
+  // libjpeg has released its image memory
+  im->memory_used -= im->jpeg_coef_size;
+  im->jpeg_coef_size = 0;
+}
+
+// Progressive (and buffered-image) decoding keeps the coefficients of the whole image
+// in memory, count these against the memory_limit.  libjpeg is also told how much of
+// the limit is left, so that it fails instead of allocating more than that, it has no
+// backing store to fall back to
+static void
+image_jpeg_memory_limit(image *im)
+{
+  struct jpeg_decompress_struct *cinfo = im->cinfo;
+  uint64_t size = 0;
+  int c;
+
+  cinfo->mem->max_memory_to_use = MAX(1, im->memory_limit - im->memory_used);
+
+  if (cinfo->progressive_mode || cinfo->buffered_image) {
+    // Same size as the virtual arrays requested by libjpeg's coefficient controller
+    for (c = 0; c < cinfo->num_components; c++) {
+      jpeg_component_info *comp = &cinfo->comp_info[c];
+      uint64_t width  = (comp->width_in_blocks + comp->h_samp_factor - 1) / comp->h_samp_factor * comp->h_samp_factor;
+      uint64_t height = (comp->height_in_blocks + comp->v_samp_factor - 1) / comp->v_samp_factor * comp->v_samp_factor;
+
+      size += width * height * sizeof(JBLOCK);
+    }
+  }
+
+  if (im->memory_limit < im->memory_used + size) {
+    uint64_t wanted = im->memory_used + size;
+    image_finish(im);
+    croak("Image::Scale memory_limit exceeded (wanted to allocate %.0f bytes)\n", (double)wanted);
+  }
+
+  DEBUG_TRACE("libjpeg coefficient buffer uses %d bytes\n", (int)size);
+
+  im->jpeg_coef_size = (int32_t)size;
+  im->memory_used += im->jpeg_coef_size;
+}
+
 int
 image_jpeg_load(image *im)
 {
-  float scale_factor;
-  int x, w, h, ofs;
+  unsigned int scale_num;
+  int x, w, h;
   unsigned char *line[1], *ptr = NULL;
 
   if (setjmp(setjmp_buffer)) {
@@ -351,6 +622,14 @@ image_jpeg_load(image *im)
       ptr = NULL;
     }
 
+    im->memory_used -= im->jpeg_coef_size;
+    im->jpeg_coef_size = 0;
+
+    if (im->jpeg_error_pub->msg_code == JERR_NO_BACKING_STORE) {
+      image_finish(im);
+      croak("Image::Scale memory_limit exceeded (libjpeg needed more memory)\n");
+    }
+
     if (im->cinfo->output_scanline > 0) {
       DEBUG_TRACE("Fatal error but already processed %d scanlines, continuing...\n", im->cinfo->output_scanline);
       return 1;
@@ -360,15 +639,6 @@ image_jpeg_load(image *im)
     return 0;
   }
 
-  // Abort on progressive JPEGs if memory_limit is in use,
-  // as progressive JPEGs can use many MBs of memory and there
-  // is no other easy way to alter libjpeg's memory use
-  if (im->memory_limit && im->cinfo->progressive_mode) {
-    warn("Image::Scale will not decode progressive JPEGs when memory_limit is in use (%s)\n", SvPVX(im->path));
-    image_jpeg_finish(im);
-    return 0;
-  }
-
   // If reusing the object a second time, we need to read the header again
   if (im->used) {
     DEBUG_TRACE("Reusing JPEG object, re-reading header\n");
@@ -384,22 +654,41 @@ image_jpeg_load(image *im)
 
     buffer_clear(im->buf);
 
+    ((buf_src_mgr *)im->cinfo->src)->thumbnail = 0;
     im->cinfo->src->bytes_in_buffer = 0;
 
     jpeg_read_header(im->cinfo, TRUE);
   }
 
+  if ( im->use_exif_thumbnail && image_jpeg_use_thumbnail(im) ) {
+    DEBUG_TRACE("Decoding %d x %d Exif thumbnail instead\n", im->exif_thumb_width, im->exif_thumb_height);
+  }
+
   im->cinfo->do_fancy_upsampling = FALSE;
   im->cinfo->do_block_smoothing = FALSE;
 
-  // Choose optimal scaling factor
+#ifdef JCS_PIX_OUT
+  // RGB and grayscale can be decoded directly as pix, CMYK still needs converting
+  if (im->cinfo->out_color_space == JCS_RGB || im->cinfo->out_color_space == JCS_GRAYSCALE)
+    im->cinfo->out_color_space = JCS_PIX_OUT;
+#endif
+
+  // Choose the smallest DCT scaling factor that is still at least the target size.
+  // libjpeg-turbo and libjpeg 7+ support any M/8, older versions round down to
+  // 1/2, 1/4 or 1/8 so checking the actual output dimensions works for both
   jpeg_calc_output_dimensions(im->cinfo);
-  scale_factor = (float)im->cinfo->output_width / im->target_width;
-  if (scale_factor > ((float)im->cinfo->output_height / im->target_height))
-    scale_factor = (float)im->cinfo->output_height / im->target_height;
-  if (scale_factor > 1) { // Avoid divide by 0
-    im->cinfo->scale_denom *= (unsigned int)scale_factor;
-    jpeg_calc_output_dimensions(im->cinfo);
+  if ( im->snap && image_jpeg_snap(im) ) {
+    DEBUG_TRACE("Snapped target size to %d x %d\n", im->target_width, im->target_height);
+  }
+  else if (im->cinfo->output_width > im->target_width && im->cinfo->output_height > im->target_height) {
+    for (scale_num = 1; scale_num <= 8; scale_num++) {
+      im->cinfo->scale_num   = scale_num;
+      im->cinfo->scale_denom = 8;
+      jpeg_calc_output_dimensions(im->cinfo);
+
+      if (im->cinfo->output_width >= im->target_width && im->cinfo->output_height >= im->target_height)
+        break;
+    }
   }
 
   w = im->cinfo->output_width;
@@ -417,30 +706,55 @@ image_jpeg_load(image *im)
   if (sv_len(im->path) > FILENAME_LEN)
     filename[FILENAME_LEN] = 0;
 
-  // XXX Tested libjpeg-turbo's JCS_EXT_XBGR but it writes zeros
-  // instead of FF for alpha, doesn't support CMYK, etc
+  // See image_jpeg_start_dc_output()
+  im->cinfo->buffered_image = im->cinfo->progressive_mode
+    && im->cinfo->scale_num * 8 == im->cinfo->scale_denom;
+
+  if (im->memory_limit)
+    image_jpeg_memory_limit(im);
 
   jpeg_start_decompress(im->cinfo);
 
-  // Allocate storage for decompressed image
-  image_alloc(im, w, h);
+  if (im->cinfo->buffered_image)
+    image_jpeg_start_dc_output(im);
+
+  // Allocate storage for decompressed image, this may be only a few rows if the
+  // resize runs as the image is decoded
+  image_alloc_rows(im, w, h);
 
-  ofs = 0;
+#ifdef JCS_PIX_OUT
+  if (im->cinfo->out_color_space == JCS_PIX_OUT) {
+    // Decode into pixbuf, as many rows at a time as libjpeg produces at once
+    pix *rows[MAX_SAMP_FACTOR];
+    int count = MIN(im->cinfo->rec_outbuf_height, MAX_SAMP_FACTOR);
+
+    while (im->cinfo->output_scanline < im->cinfo->output_height) {
+      int n = image_load_rows(im, im->cinfo->output_scanline, count, rows);
+      jpeg_read_scanlines(im->cinfo, (JSAMPARRAY)rows, n);
+    }
+
+    image_jpeg_finish_output(im);
+
+    return 1;
+  }
+#endif
 
   New(0, ptr, w * im->cinfo->output_components, unsigned char);
   line[0] = ptr;
 
   if (im->cinfo->output_components == 3) { // RGB
     while (im->cinfo->output_scanline < im->cinfo->output_height) {
+      pix *dst = image_load_row(im, im->cinfo->output_scanline);
       jpeg_read_scanlines(im->cinfo, line, 1);
       for (x = 0; x < w; x++) {
-        im->pixbuf[ofs++] = COL(ptr[x + x + x], ptr[x + x + x + 1], ptr[x + x + x + 2]);
+        dst[x] = COL(ptr[x + x + x], ptr[x + x + x + 1], ptr[x + x + x + 2]);
       }
     }
   }
   else if (im->cinfo->output_components == 4) { // CMYK inverted (Photoshop)
     while (im->cinfo->output_scanline < im->cinfo->output_height) {
       JSAMPROW row = *line;
+      pix *dst = image_load_row(im, im->cinfo->output_scanline);
       jpeg_read_scanlines(im->cinfo, line, 1);
       for (x = 0; x < w; x++) {
         int c = *row++;
@@ -448,88 +762,95 @@ image_jpeg_load(image *im)
         int y = *row++;
         int k = *row++;
 
-        im->pixbuf[ofs++] = COL((c * k) / MAXJSAMPLE, (m * k) / MAXJSAMPLE, (y * k) / MAXJSAMPLE);
+        dst[x] = COL((c * k) / MAXJSAMPLE, (m * k) / MAXJSAMPLE, (y * k) / MAXJSAMPLE);
       }
     }
   }
   else { // grayscale
     while (im->cinfo->output_scanline < im->cinfo->output_height) {
+      pix *dst = image_load_row(im, im->cinfo->output_scanline);
       jpeg_read_scanlines(im->cinfo, line, 1);
       for (x = 0; x < w; x++) {
-        im->pixbuf[ofs++] = COL(ptr[x], ptr[x], ptr[x]);
+        dst[x] = COL(ptr[x], ptr[x], ptr[x]);
       }
     }
   }
 
   Safefree(ptr);
 
-  jpeg_finish_decompress(im->cinfo);
+  image_jpeg_finish_output(im);
 
   return 1;
 }
 
 static void
-image_jpeg_compress(image *im, struct jpeg_compress_struct *cinfo, int quality)
+image_jpeg_compress_start(image *im, struct jpeg_compress_struct *cinfo, int quality)
 {
-  int x;
-#ifdef JCS_EXTENSIONS
-  JSAMPROW *data = NULL;
-#else
-  volatile unsigned char *data = NULL;
-  JSAMPROW row_pointer[1];
-  int i, row_stride;
-#endif
-
   cinfo->image_width      = im->target_width;
   cinfo->image_height     = im->target_height;
   cinfo->input_components = 3;
-  cinfo->in_color_space   = JCS_RGB; // output is always RGB even if source was grayscale
+  cinfo->in_color_space   = JCS_RGB;
 
-  if (setjmp(setjmp_buffer)) {
-    if (data != NULL)
-      Safefree(data);
-    return;
-  }
-
-#ifdef JCS_EXTENSIONS
+#ifdef JCS_PIX_IN
   // Use libjpeg-turbo support for direct reading from source buffer
   cinfo->input_components = 4;
-  cinfo->in_color_space = JCS_EXT_XBGR;
+  cinfo->in_color_space = JCS_PIX_IN;
 #endif
 
   jpeg_set_defaults(cinfo);
   jpeg_set_quality(cinfo, quality, TRUE);
-  jpeg_start_compress(cinfo, TRUE);
 
-#ifdef JCS_EXTENSIONS
-  New(0, data, im->target_height, JSAMPROW);
-
-  for (x = 0; x < im->target_height; x++)
-    data[x] = (JSAMPROW)&im->outbuf[x * im->target_width];
-
-  while (cinfo->next_scanline < cinfo->image_height) {
-    jpeg_write_scanlines(cinfo, &data[cinfo->next_scanline],
-      cinfo->image_height - cinfo->next_scanline);
+  // Grayscale stays grayscale, libjpeg only computes Y from the rows and has a single
+  // component to encode.  The Y weights add up to exactly 1, so gray values are unchanged
+  if ( image_gray_output(im) ) {
+    DEBUG_TRACE("JPEG output color space set to grayscale\n");
+    jpeg_set_colorspace(cinfo, JCS_GRAYSCALE);
   }
 
+  jpeg_start_compress(cinfo, TRUE);
+}
+
+// Compress one row of the resized image, data has room for a row of RGB
+static void
+image_jpeg_compress_row(struct jpeg_compress_struct *cinfo, pix *row, unsigned char *data)
+{
+  JSAMPROW row_pointer[1];
+#ifdef JCS_PIX_IN
+  row_pointer[0] = (JSAMPROW)row;
 #else
   // Normal libjpeg
-  row_stride = cinfo->image_width * 3;
-  New(0, data, row_stride, unsigned char);
-
-  i = 0;
-  while (cinfo->next_scanline < cinfo->image_height) {
-    for (x = 0; x < cinfo->image_width; x++) {
-      data[x + x + x]     = COL_RED(  im->outbuf[i]);
-      data[x + x + x + 1] = COL_GREEN(im->outbuf[i]);
-      data[x + x + x + 2] = COL_BLUE( im->outbuf[i]);
-      i++;
-    }
-    row_pointer[0] = (unsigned char *)data;
-    jpeg_write_scanlines(cinfo, row_pointer, 1);
+  int x;
+
+  for (x = 0; x < cinfo->image_width; x++) {
+    data[x + x + x]     = COL_RED(  row[x]);
+    data[x + x + x + 1] = COL_GREEN(row[x]);
+    data[x + x + x + 2] = COL_BLUE( row[x]);
   }
+  row_pointer[0] = (JSAMPROW)data;
 #endif
 
+  jpeg_write_scanlines(cinfo, row_pointer, 1);
+}
+
+static void
+image_jpeg_compress(image *im, struct jpeg_compress_struct *cinfo, int quality)
+{
+  int y;
+  volatile unsigned char *data = NULL;
+
+  if (setjmp(setjmp_buffer)) {
+    if (data != NULL)
+      Safefree(data);
+    return;
+  }
+
+  image_jpeg_compress_start(im, cinfo, quality);
+
+  New(0, data, im->target_width * 3, unsigned char);
+
+  for (y = 0; y < im->target_height; y++)
+    image_jpeg_compress_row(cinfo, &im->outbuf[y * im->target_width], (unsigned char *)data);
+
   jpeg_finish_compress(cinfo);
 
   Safefree(data);
@@ -578,6 +899,56 @@ image_jpeg_to_sv(image *im, int quality, SV *sv_buf)
   jpeg_destroy_compress(&cinfo);
 }
 
+// The save_jpeg resize option, see writer.c.  The encoder is started with the
+// first row, as the output size isn't final until then
+void
+image_jpeg_write_row(image *im, image_writer *w, pix *row)
+{
+  if (w->cinfo == NULL) {
+    New(0, w->cinfo, 1, struct jpeg_compress_struct);
+    New(0, w->jerr, 1, struct jpeg_error_mgr);
+    New(0, w->data, im->target_width * 3, unsigned char);
+
+    w->cinfo->err = jpeg_std_error(w->jerr);
+    jpeg_create_compress(w->cinfo);
+
+    if (w->out != NULL) {
+      jpeg_stdio_dest(w->cinfo, w->out);
+    }
+    else {
+      New(0, w->dst, 1, struct sv_dst_mgr);
+      image_jpeg_sv_dest(w->cinfo, w->dst, w->sv_buf);
+    }
+
+    image_jpeg_compress_start(im, w->cinfo, w->quality);
+  }
+
+  image_jpeg_compress_row(w->cinfo, row, w->data);
+}
+
+void
+image_jpeg_write_finish(image *im, image_writer *w, int complete)
+{
+  if (w->cinfo == NULL)
+    return;
+
+  if (complete) {
+    jpeg_finish_compress(w->cinfo);
+  }
+  else if (w->dst != NULL) {
+    // sv_dst_mgr_term won't be called
+    Safefree(w->dst->buf);
+  }
+
+  jpeg_destroy_compress(w->cinfo);
+
+  Safefree(w->cinfo);
+  Safefree(w->jerr);
+  Safefree(w->dst);
+  Safefree(w->data);
+  w->cinfo = NULL;
+}
+
 void
 image_jpeg_finish(image *im)
 {
@@ -590,5 +961,8 @@ image_jpeg_finish(image *im)
 
     Safefree(im->jpeg_error_pub);
     im->jpeg_error_pub = NULL;
+
+    im->memory_used -= im->jpeg_coef_size;
+    im->jpeg_coef_size = 0;
   }
 }
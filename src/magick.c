@@ -100,8 +100,6 @@ The licenses which components of this software fall under are as follows.
 | Copyright (C) 2002 - 2010 GraphicsMagick Group
 */
 
-#include "magick.h"
-
 static double J1(double x)
 {
   double
@@ -399,21 +397,51 @@ static float Triangle(const float x,const float ARGUNUSED(support))
   return(0.0);
 }
 
+// Also used to build the weight tables for the fixed-point version
+static const FilterInfo
+  magick_filters[SincFilter+1] =
+  {
+    { Box, 0.0 },
+    { Box, 0.0 },
+    { Box, 0.5 },
+    { Triangle, 1.0 },
+    { Hermite, 1.0 },
+    { Hanning, 1.0 },
+    { Hamming, 1.0 },
+    { Blackman, 1.0 },
+    { Gaussian, 1.25 },
+    { Quadratic, 1.5 },
+    { Cubic, 2.0 },
+    { Catrom, 2.0 },
+    { Mitchell, 2.0 },
+    { Lanczos, 3.0 },
+    { BlackmanBessel, 3.2383 },
+    { BlackmanSinc, 4.0 }
+  };
+
+// Normalization factor used when there is an alpha channel, rgb are normalized but not alpha
+static inline float
+image_downsize_gm_normalize(const ContributionInfo *contribution, int n)
+{
+  float normalize = 0.0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    normalize += contribution[i].weight;
+
+  return 1.0 / (ABS(normalize) <= EPSILON ? 1.0 : normalize);
+}
+
+// The weights only depend on the destination column (or row), so they are
+// calculated once for each pass and the filters walk the source in memory order
 static void
-image_downsize_gm_horizontal_filter(image *im, ImageInfo *source, ImageInfo *destination,
-  const float x_factor, const FilterInfo *filter_info, ContributionInfo *contribution, int rotate)
+image_downsize_gm_contributions(ContributionTable *table, const FilterInfo *filter_info,
+  const float factor, int source_len, int dst_len)
 {
   float scale, support;
   int x;
-  int dstX = 0;
-  int dstW = destination->columns;
-
-  if (im->width_padding) {
-    dstX = im->width_padding;
-    dstW = im->width_inner;
-  }
 
-  scale = BLUR * MAX(1.0 / x_factor, 1.0);
+  scale = BLUR * MAX(1.0 / factor, 1.0);
   support = scale * filter_info->support;
   if (support <= 0.5) {
     // Reduce to point sampling
@@ -422,16 +450,22 @@ image_downsize_gm_horizontal_filter(image *im, ImageInfo *source, ImageInfo *des
   }
   scale = 1.0 / scale;
 
-  for (x = dstX; (x < dstX + dstW); x++) {
+  table->max_n = (int)(2.0 * support + 3);
+  New(0, table->weights, dst_len * table->max_n, ContributionInfo);
+  New(0, table->counts, dst_len, int);
+  New(0, table->normalize, dst_len, float);
+
+  for (x = 0; x < dst_len; x++) {
+    ContributionInfo *contribution = &table->weights[x * table->max_n];
     float center, density;
-    int n, start, stop, y;
+    int n, start, stop;
 
-    center  = (float)(x - dstX + 0.5) / x_factor;
+    center  = (float)(x + 0.5) / factor;
     start   = (int)MAX(center - support + 0.5, 0);
-    stop    = (int)MIN(center + support + 0.5, source->columns);
+    stop    = (int)MIN(center + support + 0.5, source_len);
     density = 0.0;
 
-    //DEBUG_TRACE("x %d: center %.2f, start %d, stop %d\n", x, center, start, stop);
+    //DEBUG_TRACE("%d: center %.2f, start %d, stop %d\n", x, center, start, stop);
 
     for (n = 0; n < (stop - start); n++) {
       contribution[n].pixel = start + n;
@@ -451,59 +485,90 @@ image_downsize_gm_horizontal_filter(image *im, ImageInfo *source, ImageInfo *des
       }
     }
 
-    for (y = 0; y < destination->rows; y++) {
+    table->counts[x] = n;
+    table->normalize[x] = image_downsize_gm_normalize(contribution, n);
+  }
+}
+
+static void
+image_downsize_gm_contributions_free(ContributionTable *table)
+{
+  Safefree(table->weights);
+  Safefree(table->counts);
+  Safefree(table->normalize);
+}
+
+static inline void
+image_downsize_gm_put_pix(image *im, ImageInfo *destination, int x, int y, pix col, int rotate)
+{
+  if (rotate && im->orientation != ORIENTATION_NORMAL) {
+    int ox, oy; // new destination pixel coordinates after rotating
+
+    image_get_rotated_coords(im, x, y, &ox, &oy);
+
+    if (im->orientation >= 5) {
+      // 90 and 270 rotations, width/height are swapped
+      destination->buf[(oy * destination->rows) + ox] = col;
+    }
+    else {
+      destination->buf[(oy * destination->columns) + ox] = col;
+    }
+  }
+  else {
+    destination->buf[(y * destination->columns) + x] = col;
+  }
+}
+
+static void
+image_downsize_gm_horizontal_filter_generic(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTable *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstX = 0;
+  int dstW = destination->columns;
+
+  if (im->width_padding) {
+    dstX = im->width_padding;
+    dstW = im->width_inner;
+  }
+
+  for (y = start; y < end; y++) {
+    pix *row = &source->buf[y * source->columns];
+
+    for (x = 0; x < dstW; x++) {
+      ContributionInfo *contribution = &table->weights[x * table->max_n];
+      int n = table->counts[x];
       float weight;
       float red = 0.0, green = 0.0, blue = 0.0, alpha = 0.0;
       pix p;
-      int j;
       register int i;
 
-      //DEBUG_TRACE("y %d:\n", y);
-
       if (im->has_alpha) {
         float normalize;
 
-        normalize = 0.0;
         for (i = 0; i < n; i++) {
-          j = (int)((y * source->columns) + contribution[i].pixel);
           weight = contribution[i].weight;
-          p = source->buf[j];
+          p = row[contribution[i].pixel];
 
           // XXX The original GM code weighted based on transparency for some reason,
           // but this produces bad results, so we use only the weight
           //transparency_coeff = weight * ((float)COL_ALPHA(p) / 255);
 
-          /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d %d) weight %.2f\n",
-            x, contribution[i].pixel, j,
-            COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p),
-            weight);
-          */
-
           red   += weight * COL_RED(p);
           green += weight * COL_GREEN(p);
           blue  += weight * COL_BLUE(p);
           alpha += weight * COL_ALPHA(p);
-          normalize += weight;
         }
 
-        normalize = 1.0 / (ABS(normalize) <= EPSILON ? 1.0 : normalize);
+        normalize = table->normalize[x];
         red   *= normalize;
         green *= normalize;
         blue  *= normalize;
       }
       else {
         for (i = 0; i < n; i++) {
-          j = (int)((y * source->columns) + contribution[i].pixel);
           weight = contribution[i].weight;
-          p = source->buf[j];
-
-          /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d) weight %.2f\n",
-            contribution[i].pixel, y, j,
-            COL_RED(p), COL_GREEN(p), COL_BLUE(p),
-            weight);
-          */
+          p = row[contribution[i].pixel];
 
           red   += weight * COL_RED(p);
           green += weight * COL_GREEN(p);
@@ -513,159 +578,52 @@ image_downsize_gm_horizontal_filter(image *im, ImageInfo *source, ImageInfo *des
         alpha = 255.0;
       }
 
-      /*
-      DEBUG_TRACE("  -> (%d, %d) @ %d (%d %d %d %d)\n",
-        x, y, (y * destination->columns) + x,
-        ROUND_FLOAT_TO_INT(red),
-        ROUND_FLOAT_TO_INT(green),
-        ROUND_FLOAT_TO_INT(blue),
-        ROUND_FLOAT_TO_INT(alpha));
-      */
-
-      if (rotate && im->orientation != ORIENTATION_NORMAL) {
-        int ox, oy; // new destination pixel coordinates after rotating
-
-        image_get_rotated_coords(im, x, y, &ox, &oy);
-
-        if (im->orientation >= 5) {
-          // 90 and 270 rotations, width/height are swapped
-          destination->buf[(oy * destination->rows) + ox] = COL_FULL(
-            ROUND_FLOAT_TO_INT(red),
-            ROUND_FLOAT_TO_INT(green),
-            ROUND_FLOAT_TO_INT(blue),
-            ROUND_FLOAT_TO_INT(alpha)
-          );
-        }
-        else {
-          destination->buf[(oy * destination->columns) + ox] = COL_FULL(
-            ROUND_FLOAT_TO_INT(red),
-            ROUND_FLOAT_TO_INT(green),
-            ROUND_FLOAT_TO_INT(blue),
-            ROUND_FLOAT_TO_INT(alpha)
-          );
-        }
-      }
-      else {
-        destination->buf[(y * destination->columns) + x] = COL_FULL(
-          ROUND_FLOAT_TO_INT(red),
-          ROUND_FLOAT_TO_INT(green),
-          ROUND_FLOAT_TO_INT(blue),
-          ROUND_FLOAT_TO_INT(alpha)
-        );
-      }
+      image_downsize_gm_put_pix(
+        im, destination, x + dstX, y,
+        COL_FULL(ROUND_FLOAT_TO_COL(red), ROUND_FLOAT_TO_COL(green), ROUND_FLOAT_TO_COL(blue), ROUND_FLOAT_TO_COL(alpha)),
+        rotate
+      );
     }
   }
 }
 
 static void
-image_downsize_gm_vertical_filter(image *im, ImageInfo *source, ImageInfo *destination,
-  const float y_factor, const FilterInfo *filter_info, ContributionInfo *contribution, int rotate)
+image_downsize_gm_vertical_filter_generic(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTable *table, int rotate, int start, int end)
 {
-  float scale, support;
-  int y;
-  int dstY = 0;
-  int dstH = destination->rows;
+  int x, y;
+  int dstY = im->height_padding; // destination rows start below any padding
 
-  if (im->height_padding) {
-    dstY = im->height_padding;
-    dstH = im->height_inner;
-  }
-
-  //DEBUG_TRACE("y_factor %.2f\n", y_factor);
-
-  // Apply filter to resize vertically from source to destination
-  scale = BLUR * MAX(1.0 / y_factor, 1.0);
-  support = scale * filter_info->support;
-  if (support <= 0.5) {
-    // Reduce to point sampling
-    support = 0.5 + EPSILON;
-    scale = 1.0;
-  }
-  scale = 1.0 / scale;
-
-  for (y = dstY; (y < dstY + dstH); y++) {
-    float center, density;
-    int n, start, stop, x;
-
-    center  = (float)(y - dstY + 0.5) / y_factor;
-    start   = (int)MAX(center - support + 0.5, 0);
-    stop    = (int)MIN(center + support + 0.5, source->rows);
-    density = 0.0;
-
-    //DEBUG_TRACE("y %d: center %.2f, start %d, stop %d\n", y, center, start, stop);
-
-    for (n = 0; n < (stop - start); n++) {
-      contribution[n].pixel = start + n;
-      contribution[n].weight = filter_info->function(scale * (start + n - center + 0.5), filter_info->support);
-      density += contribution[n].weight;
-      //DEBUG_TRACE("  contribution[%d].pixel %d, weight %.2f, density %.2f\n", n, contribution[n].pixel, contribution[n].weight, density);
-    }
-
-    if ((density != 0.0) && (density != 1.0)) {
-      // Normalize
-      int i;
-
-      density = 1.0 / density;
-      for (i = 0; i < n; i++) {
-        contribution[i].weight *= density;
-        //DEBUG_TRACE("  normalize contribution[%d].weight to %.2f\n", i, contribution[i].weight);
-      }
-    }
+  for (y = start; y < end; y++) {
+    ContributionInfo *contribution = &table->weights[y * table->max_n];
+    int n = table->counts[y];
+    float normalize = im->has_alpha ? table->normalize[y] : 1.0;
 
     for (x = 0; x < destination->columns; x++) {
       float weight;
       float red = 0.0, green = 0.0, blue = 0.0, alpha = 0.0;
       pix p;
-      int j;
       register int i;
 
-      //DEBUG_TRACE("x %d:\n", x);
-
       if (im->has_alpha) {
-        float normalize;
-
-        normalize = 0.0;
         for (i = 0; i < n; i++) {
-          j = (int)((contribution[i].pixel * source->columns) + x);
           weight = contribution[i].weight;
-          p = source->buf[j];
-
-          // XXX The original GM code weighted based on transparency for some reason,
-          // but this produces bad results, so we use only the weight
-          //transparency_coeff = weight * ((float)COL_ALPHA(p) / 255);
-
-          /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d %d) weight %.2f\n",
-            x, contribution[i].pixel, j,
-            COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p),
-            weight
-          );
-          */
+          p = source->buf[(contribution[i].pixel * source->columns) + x];
 
           red   += weight * COL_RED(p);
           green += weight * COL_GREEN(p);
           blue  += weight * COL_BLUE(p);
           alpha += weight * COL_ALPHA(p);
-          normalize += weight;
         }
 
-        normalize = 1.0 / (ABS(normalize) <= EPSILON ? 1.0 : normalize);
         red   *= normalize;
         green *= normalize;
         blue  *= normalize;
       }
       else {
         for (i = 0; i < n; i++) {
-          j = (int)((contribution[i].pixel * source->columns) + x);
           weight = contribution[i].weight;
-          p = source->buf[j];
-
-          /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d) weight %.2f\n",
-            x, contribution[i].pixel, j,
-            COL_RED(p), COL_GREEN(p), COL_BLUE(p),
-            weight);
-          */
+          p = source->buf[(contribution[i].pixel * source->columns) + x];
 
           red   += weight * COL_RED(p);
           green += weight * COL_GREEN(p);
@@ -675,81 +633,323 @@ image_downsize_gm_vertical_filter(image *im, ImageInfo *source, ImageInfo *desti
         alpha = 255.0;
       }
 
-      /*
-      DEBUG_TRACE("  -> (%d, %d) @ %d (%d %d %d %d)\n",
-        x, y, (y * destination->columns) + x,
-        ROUND_FLOAT_TO_INT(red),
-        ROUND_FLOAT_TO_INT(green),
-        ROUND_FLOAT_TO_INT(blue),
-        ROUND_FLOAT_TO_INT(alpha));
-      */
+      image_downsize_gm_put_pix(
+        im, destination, x, y + dstY,
+        COL_FULL(ROUND_FLOAT_TO_COL(red), ROUND_FLOAT_TO_COL(green), ROUND_FLOAT_TO_COL(blue), ROUND_FLOAT_TO_COL(alpha)),
+        rotate
+      );
+    }
+  }
+}
+
+#ifdef HAVE_SIMD
+// SIMD versions of the filters.  Each pix is expanded to 4 floats in memory order
+// (alpha, blue, green, red) so all of its channels are merged at once.  Rounding
+// and clamping to 0-255 is done by the saturating packs, which gives the same
+// result as ROUND_FLOAT_TO_COL.
+
+static inline __m128 TARGET_SSE41
+image_downsize_gm_load_pix_sse41(pix p)
+{
+  return _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128(p) ) );
+}
+
+static inline pix TARGET_SSE41
+image_downsize_gm_pack_pix_sse41(__m128 v)
+{
+  __m128i i = _mm_cvtps_epi32(v);
+
+  i = _mm_packs_epi32(i, i);
+  i = _mm_packus_epi16(i, i);
+
+  return (pix)_mm_cvtsi128_si32(i);
+}
+
+static void TARGET_SSE41
+image_downsize_gm_horizontal_filter_sse41(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTable *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstX = 0;
+  int dstW = destination->columns;
+
+  if (im->width_padding) {
+    dstX = im->width_padding;
+    dstW = im->width_inner;
+  }
+
+  for (y = start; y < end; y++) {
+    pix *row = &source->buf[y * source->columns];
+
+    for (x = 0; x < dstW; x++) {
+      ContributionInfo *contribution = &table->weights[x * table->max_n];
+      int n = table->counts[x];
+      __m128 sum = _mm_setzero_ps();
+      pix col;
+      int i;
+
+      for (i = 0; i < n; i++) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(
+          image_downsize_gm_load_pix_sse41(row[contribution[i].pixel]), _mm_set1_ps(contribution[i].weight)
+        ));
+      }
+
+      if (im->has_alpha) // rgb are normalized, (1, n, n, n) in memory order
+        col = image_downsize_gm_pack_pix_sse41( _mm_mul_ps(sum, _mm_set_ps(table->normalize[x], table->normalize[x], table->normalize[x], 1.0)) );
+      else
+        col = image_downsize_gm_pack_pix_sse41(sum) | 0xFF;
+
+      image_downsize_gm_put_pix(im, destination, x + dstX, y, col, rotate);
+    }
+  }
+
+}
+
+// 4 destination pixels are filtered at a time
+static void TARGET_SSE41
+image_downsize_gm_vertical_filter_sse41(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTable *table, int rotate, int start, int end)
+{
+  int x, y, i;
+  int dstY = im->height_padding; // destination rows start below any padding
+  const __m128i opaque = _mm_set1_epi32(0xFF);
+
+  for (y = start; y < end; y++) {
+    ContributionInfo *contribution = &table->weights[y * table->max_n];
+    int n = table->counts[y];
+    float normalize = im->has_alpha ? table->normalize[y] : 1.0;
+    __m128 scale = _mm_set_ps(normalize, normalize, normalize, 1.0);
+
+    for (x = 0; x + 4 <= destination->columns; x += 4) {
+      __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+      __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+      __m128i out;
+
+      for (i = 0; i < n; i++) {
+        __m128i v = _mm_loadu_si128( (__m128i *)&source->buf[(contribution[i].pixel * source->columns) + x] );
+        __m128 weight = _mm_set1_ps(contribution[i].weight);
+
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps( _mm_cvtepi32_ps(_mm_cvtepu8_epi32(v)), weight ));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps( _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4))), weight ));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps( _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 8))), weight ));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps( _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 12))), weight ));
+      }
+
+      if (im->has_alpha) {
+        acc0 = _mm_mul_ps(acc0, scale);
+        acc1 = _mm_mul_ps(acc1, scale);
+        acc2 = _mm_mul_ps(acc2, scale);
+        acc3 = _mm_mul_ps(acc3, scale);
+      }
+
+      out = _mm_packus_epi16(
+        _mm_packs_epi32( _mm_cvtps_epi32(acc0), _mm_cvtps_epi32(acc1) ),
+        _mm_packs_epi32( _mm_cvtps_epi32(acc2), _mm_cvtps_epi32(acc3) )
+      );
+
+      if (!im->has_alpha)
+        out = _mm_or_si128(out, opaque);
 
       if (rotate && im->orientation != ORIENTATION_NORMAL) {
-        int ox, oy; // new destination pixel coordinates after rotating
-
-        image_get_rotated_coords(im, x, y, &ox, &oy);
-
-        if (im->orientation >= 5) {
-          // 90 and 270 rotations, width/height are swapped
-          destination->buf[(oy * destination->rows) + ox] = COL_FULL(
-            ROUND_FLOAT_TO_INT(red),
-            ROUND_FLOAT_TO_INT(green),
-            ROUND_FLOAT_TO_INT(blue),
-            ROUND_FLOAT_TO_INT(alpha)
-          );
-        }
-        else {
-          destination->buf[(oy * destination->columns) + ox] = COL_FULL(
-            ROUND_FLOAT_TO_INT(red),
-            ROUND_FLOAT_TO_INT(green),
-            ROUND_FLOAT_TO_INT(blue),
-            ROUND_FLOAT_TO_INT(alpha)
-          );
-        }
+        pix cols[4];
+        int j;
+
+        _mm_storeu_si128((__m128i *)cols, out);
+        for (j = 0; j < 4; j++)
+          image_downsize_gm_put_pix(im, destination, x + j, y + dstY, cols[j], rotate);
       }
       else {
-        destination->buf[(y * destination->columns) + x] = COL_FULL(
-          ROUND_FLOAT_TO_INT(red),
-          ROUND_FLOAT_TO_INT(green),
-          ROUND_FLOAT_TO_INT(blue),
-          ROUND_FLOAT_TO_INT(alpha)
+        _mm_storeu_si128((__m128i *)&destination->buf[((y + dstY) * destination->columns) + x], out);
+      }
+    }
+
+    // Remaining pixels one at a time
+    for ( ; x < destination->columns; x++) {
+      __m128 sum = _mm_setzero_ps();
+      pix col;
+
+      for (i = 0; i < n; i++) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(
+          image_downsize_gm_load_pix_sse41( source->buf[(contribution[i].pixel * source->columns) + x] ),
+          _mm_set1_ps(contribution[i].weight)
+        ));
+      }
+
+      if (im->has_alpha)
+        col = image_downsize_gm_pack_pix_sse41( _mm_mul_ps(sum, scale) );
+      else
+        col = image_downsize_gm_pack_pix_sse41(sum) | 0xFF;
+
+      image_downsize_gm_put_pix(im, destination, x, y + dstY, col, rotate);
+    }
+  }
+}
+
+// The AVX2 horizontal filter merges two adjacent source pixels per FMA
+static void TARGET_AVX2
+image_downsize_gm_horizontal_filter_avx2(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTable *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstX = 0;
+  int dstW = destination->columns;
+
+  if (im->width_padding) {
+    dstX = im->width_padding;
+    dstW = im->width_inner;
+  }
+
+  for (y = start; y < end; y++) {
+    pix *row = &source->buf[y * source->columns];
+
+    for (x = 0; x < dstW; x++) {
+      ContributionInfo *contribution = &table->weights[x * table->max_n];
+      int n = table->counts[x];
+      pix *p = n ? row + contribution[0].pixel : row; // the source pixels are adjacent
+      __m256 acc = _mm256_setzero_ps();
+      __m128 sum;
+      pix col;
+      int i;
+
+      for (i = 0; i + 1 < n; i += 2) {
+        __m256 px = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64((__m128i *)(p + i)) ) );
+        __m256 weight = _mm256_set_ps(
+          contribution[i + 1].weight, contribution[i + 1].weight, contribution[i + 1].weight, contribution[i + 1].weight,
+          contribution[i].weight, contribution[i].weight, contribution[i].weight, contribution[i].weight
+        );
+        acc = _mm256_fmadd_ps(px, weight, acc);
+      }
+
+      sum = _mm_add_ps( _mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1) );
+
+      if (i < n)
+        sum = _mm_fmadd_ps( image_downsize_gm_load_pix_sse41(p[i]), _mm_set1_ps(contribution[i].weight), sum );
+
+      if (im->has_alpha) // rgb are normalized, (1, n, n, n) in memory order
+        col = image_downsize_gm_pack_pix_sse41( _mm_mul_ps(sum, _mm_set_ps(table->normalize[x], table->normalize[x], table->normalize[x], 1.0)) );
+      else
+        col = image_downsize_gm_pack_pix_sse41(sum) | 0xFF;
+
+      image_downsize_gm_put_pix(im, destination, x + dstX, y, col, rotate);
+    }
+  }
+
+}
+
+// 8 destination pixels are filtered at a time
+static void TARGET_AVX2
+image_downsize_gm_vertical_filter_avx2(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTable *table, int rotate, int start, int end)
+{
+  int x, y, i;
+  int dstY = im->height_padding; // destination rows start below any padding
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  const __m256i opaque = _mm256_set1_epi32(0xFF);
+
+  for (y = start; y < end; y++) {
+    ContributionInfo *contribution = &table->weights[y * table->max_n];
+    int n = table->counts[y];
+    float normalize = im->has_alpha ? table->normalize[y] : 1.0;
+    __m256 scale = _mm256_set_ps(normalize, normalize, normalize, 1.0, normalize, normalize, normalize, 1.0);
+
+    for (x = 0; x + 8 <= destination->columns; x += 8) {
+      __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+      __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+      __m256i out;
+
+      for (i = 0; i < n; i++) {
+        __m256i v = _mm256_loadu_si256( (__m256i *)&source->buf[(contribution[i].pixel * source->columns) + x] );
+        __m128i lo = _mm256_castsi256_si128(v);
+        __m128i hi = _mm256_extracti128_si256(v, 1);
+        __m256 weight = _mm256_set1_ps(contribution[i].weight);
+
+        acc0 = _mm256_fmadd_ps( _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(lo)), weight, acc0 );
+        acc1 = _mm256_fmadd_ps( _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8))), weight, acc1 );
+        acc2 = _mm256_fmadd_ps( _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(hi)), weight, acc2 );
+        acc3 = _mm256_fmadd_ps( _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8))), weight, acc3 );
+      }
+
+      if (im->has_alpha) {
+        acc0 = _mm256_mul_ps(acc0, scale);
+        acc1 = _mm256_mul_ps(acc1, scale);
+        acc2 = _mm256_mul_ps(acc2, scale);
+        acc3 = _mm256_mul_ps(acc3, scale);
+      }
+
+      // Packing works within each 128-bit lane, leaving the pixels in the order 0 2 4 6 1 3 5 7
+      out = _mm256_packus_epi16(
+        _mm256_packs_epi32( _mm256_cvtps_epi32(acc0), _mm256_cvtps_epi32(acc1) ),
+        _mm256_packs_epi32( _mm256_cvtps_epi32(acc2), _mm256_cvtps_epi32(acc3) )
+      );
+      out = _mm256_permutevar8x32_epi32(out, order);
+
+      if (!im->has_alpha)
+        out = _mm256_or_si256(out, opaque);
+
+      if (rotate && im->orientation != ORIENTATION_NORMAL) {
+        pix cols[8];
+        int j;
+
+        _mm256_storeu_si256((__m256i *)cols, out);
+        for (j = 0; j < 8; j++)
+          image_downsize_gm_put_pix(im, destination, x + j, y + dstY, cols[j], rotate);
+      }
+      else {
+        _mm256_storeu_si256((__m256i *)&destination->buf[((y + dstY) * destination->columns) + x], out);
+      }
+    }
+
+    // Remaining pixels one at a time
+    for ( ; x < destination->columns; x++) {
+      __m128 sum = _mm_setzero_ps();
+      pix col;
+
+      for (i = 0; i < n; i++) {
+        sum = _mm_fmadd_ps(
+          image_downsize_gm_load_pix_sse41( source->buf[(contribution[i].pixel * source->columns) + x] ),
+          _mm_set1_ps(contribution[i].weight),
+          sum
         );
       }
+
+      if (im->has_alpha)
+        col = image_downsize_gm_pack_pix_sse41( _mm_mul_ps(sum, _mm256_castps256_ps128(scale)) );
+      else
+        col = image_downsize_gm_pack_pix_sse41(sum) | 0xFF;
+
+      image_downsize_gm_put_pix(im, destination, x, y + dstY, col, rotate);
     }
   }
 }
+#endif
+
+static void
+image_downsize_gm_horizontal_job(image *im, void *arg, int part, int start, int end)
+{
+  FilterPass *pass = (FilterPass *)arg;
+
+  simd->gm_horizontal_filter(im, pass->source, pass->destination, pass->table, pass->rotate, start, end);
+}
+
+static void
+image_downsize_gm_vertical_job(image *im, void *arg, int part, int start, int end)
+{
+  FilterPass *pass = (FilterPass *)arg;
+
+  simd->gm_vertical_filter(im, pass->source, pass->destination, pass->table, pass->rotate, start, end);
+}
 
 void
 image_downsize_gm(image *im)
 {
   float x_factor, y_factor;
-  float support, x_support, y_support;
   int columns, rows;
   int order;
+  int dstH = im->height_padding ? im->height_inner : im->target_height;
   int filter;
-  ContributionInfo *contribution;
+  ContributionTable x_table, y_table;
   ImageInfo source, destination;
-
-  static const FilterInfo
-    filters[SincFilter+1] =
-    {
-      { Box, 0.0 },
-      { Box, 0.0 },
-      { Box, 0.5 },
-      { Triangle, 1.0 },
-      { Hermite, 1.0 },
-      { Hanning, 1.0 },
-      { Hamming, 1.0 },
-      { Blackman, 1.0 },
-      { Gaussian, 1.25 },
-      { Quadratic, 1.5 },
-      { Cubic, 2.0 },
-      { Catrom, 2.0 },
-      { Mitchell, 2.0 },
-      { Lanczos, 3.0 },
-      { BlackmanBessel, 3.2383 },
-      { BlackmanSinc, 4.0 }
-    };
+  FilterPass horizontal, vertical;
 
   columns = im->target_width;
   rows = im->target_height;
@@ -779,21 +979,24 @@ image_downsize_gm(image *im)
   else
     y_factor = (float)im->target_height / im->height;
 
-  x_support = BLUR * MAX(1.0 / x_factor, 1.0) * filters[filter].support;
-  y_support = BLUR * MAX(1.0 / y_factor, 1.0) * filters[filter].support;
-  support = MAX(x_support, y_support);
-  if (support < filters[filter].support)
-    support = filters[filter].support;
-
-  DEBUG_TRACE("ContributionInfo allocated for %ld items\n", (size_t)(2.0 * MAX(support, 0.5) + 3));
-  New(0, contribution, (size_t)(2.0 * MAX(support, 0.5) + 3), ContributionInfo);
+  DEBUG_TRACE("order %d, x_factor %f, y_factor %f\n", order, x_factor, y_factor);
 
-  DEBUG_TRACE("order %d, x_factor %f, y_factor %f, support %f\n", order, x_factor, y_factor, support);
+  image_downsize_gm_contributions(
+    &x_table, &magick_filters[filter], x_factor, im->width, im->width_padding ? im->width_inner : im->target_width
+  );
+  image_downsize_gm_contributions(
+    &y_table, &magick_filters[filter], y_factor, im->height, dstH
+  );
 
   source.rows    = im->height;
   source.columns = im->width;
   source.buf     = im->pixbuf;
 
+  horizontal.source      = vertical.source      = &source;
+  horizontal.destination = vertical.destination = &destination;
+  horizontal.table       = &x_table;
+  vertical.table         = &y_table;
+
   if (order) {
     DEBUG_TRACE("Allocating temporary buffer size %ld\n", im->target_width * im->height * sizeof(pix));
     New(0, im->tmpbuf, im->target_width * im->height, pix);
@@ -805,7 +1008,8 @@ image_downsize_gm(image *im)
     destination.rows    = im->height;
     destination.columns = im->target_width;
     destination.buf     = im->tmpbuf;
-    image_downsize_gm_horizontal_filter(im, &source, &destination, x_factor, &filters[filter], contribution, 0);
+    horizontal.rotate = 0;
+    image_pool_run(im, destination.rows, image_downsize_gm_horizontal_job, &horizontal);
 
     // Resize vertically from tmp -> out
     source.rows    = destination.rows;
@@ -814,7 +1018,8 @@ image_downsize_gm(image *im)
 
     destination.rows = im->target_height;
     destination.buf  = im->outbuf;
-    image_downsize_gm_vertical_filter(im, &source, &destination, y_factor, &filters[filter], contribution, 1);
+    vertical.rotate = 1;
+    image_pool_run(im, dstH, image_downsize_gm_vertical_job, &vertical);
   }
   else {
     DEBUG_TRACE("Allocating temporary buffer size %ld\n", im->width * im->target_height * sizeof(pix));
@@ -827,7 +1032,8 @@ image_downsize_gm(image *im)
     destination.rows    = im->target_height;
     destination.columns = im->width;
     destination.buf     = im->tmpbuf;
-    image_downsize_gm_vertical_filter(im, &source, &destination, y_factor, &filters[filter], contribution, 0);
+    vertical.rotate = 0;
+    image_pool_run(im, dstH, image_downsize_gm_vertical_job, &vertical);
 
     // Resize horizontally from tmp -> out
     source.rows    = destination.rows;
@@ -836,9 +1042,11 @@ image_downsize_gm(image *im)
 
     destination.columns = im->target_width;
     destination.buf     = im->outbuf;
-    image_downsize_gm_horizontal_filter(im, &source, &destination, x_factor, &filters[filter], contribution, 1);
+    horizontal.rotate = 1;
+    image_pool_run(im, destination.rows, image_downsize_gm_horizontal_job, &horizontal);
   }
 
   Safefree(im->tmpbuf);
-  Safefree(contribution);
+  image_downsize_gm_contributions_free(&x_table);
+  image_downsize_gm_contributions_free(&y_table);
 }
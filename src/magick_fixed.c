@@ -1,14 +1,5 @@
 // Fixed-point version of magick.c
 
-static fixed_t BoxFixed(const fixed_t x,const fixed_t ARGUNUSED(support))
-{
-  if (x < -FIXED_HALF)
-    return 0;
-  if (x < FIXED_HALF)
-    return FIXED_1;
-  return 0;
-}
-
 static fixed_t TriangleFixed(const fixed_t x,const fixed_t ARGUNUSED(support))
 {
   if (x < -FIXED_1)
@@ -20,351 +11,647 @@ static fixed_t TriangleFixed(const fixed_t x,const fixed_t ARGUNUSED(support))
   return 0;
 }
 
-// Other filters could be ported but they are increasingly more complex and
-// include a lot of multiplication, divisison, and/or trig functions
+static const FilterInfoFixed triangle_filter_fixed = { TriangleFixed, FIXED_1 };
+
+// Normalization factor used when there is an alpha channel, rgb are normalized but not alpha
+static inline fixed_t
+image_downsize_gm_normalize_fixed(const ContributionInfoFixed *contribution, int n)
+{
+  fixed_t normalize = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    normalize += contribution[i].weight;
+
+  return fixed_div(FIXED_1, (ABS(normalize) <= FIXED_EPSILON ? FIXED_1 : normalize));
+}
+
+// The other filters are increasingly more complex and include a lot of multiplication,
+// division, and/or trig functions.  Rather than porting them, their weights are
+// evaluated once per resize in floating-point by the magick.c versions and stored
+// in a table of fixed-point weights, so the filtering itself is still integer-only.
 
 static void
-image_downsize_gm_horizontal_filter_fixed_point(image *im, ImageInfo *source, ImageInfo *destination,
-  const fixed_t x_factor, const FilterInfoFixed *filter_info, ContributionInfoFixed *contribution, int rotate)
+image_downsize_gm_contributions_fixed_point(ContributionTableFixed *table, int filter,
+  const float factor, int source_len, int dst_len)
 {
-  fixed_t scale, support;
   int x;
-  int dstX = 0;
-  int dstW = destination->columns;
 
-  if (im->width_padding) {
-    dstX = im->width_padding;
-    dstW = im->width_inner;
-  }
+  if (filter == TriangleFilter) {
+    // Triangle has always been evaluated entirely in fixed-point, keep its output unchanged
+    const FilterInfoFixed *filter_info = &triangle_filter_fixed;
+    fixed_t fixed_factor = float_to_fixed(factor);
+    fixed_t scale, support;
+
+    scale = MAX(fixed_div(FIXED_1, fixed_factor), FIXED_1);
+    support = fixed_mul(scale, filter_info->support);
+    if (support <= FIXED_HALF) {
+      // Reduce to point sampling
+      support = FIXED_HALF + FIXED_EPSILON;
+      scale = FIXED_1;
+    }
+    scale = fixed_div(FIXED_1, scale);
 
-  scale = MAX(fixed_div(FIXED_1, x_factor), FIXED_1);
-  support = fixed_mul(scale, filter_info->support);
-  if (support <= FIXED_HALF) {
-    // Reduce to point sampling
-    support = FIXED_HALF + FIXED_EPSILON;
-    scale = FIXED_1;
-  }
-  scale = fixed_div(FIXED_1, scale);
+    table->max_n = fixed_to_int(2 * support) + 3;
+    New(0, table->weights, dst_len * table->max_n, ContributionInfoFixed);
+    New(0, table->counts, dst_len, int);
+
+    for (x = 0; x < dst_len; x++) {
+      ContributionInfoFixed *contribution = &table->weights[x * table->max_n];
+      fixed_t center, density;
+      int n, start, stop;
+
+      center  = fixed_div(int_to_fixed(x) + FIXED_HALF, fixed_factor);
+      start   = fixed_to_int(MAX(center - support + FIXED_HALF, 0));
+      stop    = fixed_to_int(MIN(center + support + FIXED_HALF, int_to_fixed(source_len)));
+      density = 0;
+
+      //DEBUG_TRACE("%d: center %.2f, start %d, stop %d\n", x, fixed_to_float(center), start, stop);
 
-  for (x = dstX; (x < dstX + dstW); x++) {
-    fixed_t center, density;
-    int n, start, stop, y;
+      for (n = 0; n < (stop - start); n++) {
+        contribution[n].pixel = start + n;
+        contribution[n].weight = filter_info->function(fixed_mul(scale, (int_to_fixed(start) + int_to_fixed(n) - center + FIXED_HALF)), filter_info->support);
+        density += contribution[n].weight;
+        //DEBUG_TRACE("  contribution[%d].pixel %d, weight %.2f, density %.2f\n", n, contribution[n].pixel, contribution[n].weight, density);
+      }
 
-    center  = fixed_div(int_to_fixed(x - dstX) + FIXED_HALF, x_factor);
-    start   = fixed_to_int(MAX(center - support + FIXED_HALF, 0));
-    stop    = fixed_to_int(MIN(center + support + FIXED_HALF, int_to_fixed(source->columns)));
-    density = 0;
+      if ((density != 0) && (density != FIXED_1)) {
+        // Normalize
+        int i;
 
-    //DEBUG_TRACE("x %d: center %.2f, start %d, stop %d\n", x, center, start, stop);
+        density = fixed_div(FIXED_1, density);
+        for (i = 0; i < n; i++) {
+          contribution[i].weight = fixed_mul(contribution[i].weight, density);
+          //DEBUG_TRACE("  normalize contribution[%d].weight to %.2f\n", i, fixed_to_float(contribution[i].weight));
+        }
+      }
 
-    for (n = 0; n < (stop - start); n++) {
-      contribution[n].pixel = start + n;
-      contribution[n].weight = filter_info->function(fixed_mul(scale, (int_to_fixed(start) + int_to_fixed(n) - center + FIXED_HALF)), filter_info->support);
-      density += contribution[n].weight;
-      //DEBUG_TRACE("  contribution[%d].pixel %d, weight %.2f, density %.2f\n", n, contribution[n].pixel, contribution[n].weight, density);
+      table->counts[x] = n;
     }
+  }
+  else {
+    ContributionTable float_table;
 
-    if ((density != 0) && (density != FIXED_1)) {
-      // Normalize
-      int i;
+    image_downsize_gm_contributions(&float_table, &magick_filters[filter], factor, source_len, dst_len);
+
+    table->max_n = float_table.max_n;
+    New(0, table->weights, dst_len * table->max_n, ContributionInfoFixed);
+    New(0, table->counts, dst_len, int);
+
+    for (x = 0; x < dst_len; x++) {
+      ContributionInfo *weights = &float_table.weights[x * table->max_n];
+      ContributionInfoFixed *contribution = &table->weights[x * table->max_n];
+      fixed_t total = 0;
+      int n = float_table.counts[x];
+      int i, largest = 0;
 
-      density = fixed_div(FIXED_1, density);
       for (i = 0; i < n; i++) {
-        contribution[i].weight = fixed_mul(contribution[i].weight, density);
-        //DEBUG_TRACE("  normalize contribution[%d].weight to %.2f\n", i, fixed_to_float(contribution[i].weight));
+        float w = weights[i].weight * FIXED_1;
+
+        contribution[i].pixel = weights[i].pixel;
+        contribution[i].weight = (fixed_t)(w < 0 ? w - 0.5 : w + 0.5);
+        total += contribution[i].weight;
+
+        if (contribution[i].weight > contribution[largest].weight)
+          largest = i;
+
+        //DEBUG_TRACE("  contribution[%d].pixel %d, weight %.2f\n", i, contribution[i].pixel, fixed_to_float(contribution[i].weight));
       }
+
+      // Give the rounding error to the largest weight so the weights still add up to exactly 1
+      if (n && total != 0)
+        contribution[largest].weight += FIXED_1 - total;
+
+      table->counts[x] = n;
     }
 
-    for (y = 0; y < destination->rows; y++) {
+    image_downsize_gm_contributions_free(&float_table);
+  }
+
+  // The SIMD filters accumulate in 32 bits, flag any weights that could overflow that
+  New(0, table->normalize, dst_len, fixed_t);
+  table->overflow = 0;
+  for (x = 0; x < dst_len; x++) {
+    ContributionInfoFixed *contribution = &table->weights[x * table->max_n];
+    int64_t sum = 0;
+    int i;
+
+    for (i = 0; i < table->counts[x]; i++)
+      sum += ABS((int64_t)contribution[i].weight);
+
+    if (sum * 255 + FIXED_HALF > INT32_MAX)
+      table->overflow = 1;
+
+    table->normalize[x] = image_downsize_gm_normalize_fixed(contribution, table->counts[x]);
+  }
+}
+
+static void
+image_downsize_gm_contributions_fixed_point_free(ContributionTableFixed *table)
+{
+  Safefree(table->weights);
+  Safefree(table->counts);
+  Safefree(table->normalize);
+}
+
+static void
+image_downsize_gm_horizontal_filter_fixed_point_generic(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTableFixed *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstX = 0;
+  int dstW = destination->columns;
+
+  if (im->width_padding) {
+    dstX = im->width_padding;
+    dstW = im->width_inner;
+  }
+
+  for (y = start; y < end; y++) {
+    pix *row = &source->buf[y * source->columns];
+
+    //DEBUG_TRACE("y %d:\n", y);
+
+    for (x = 0; x < dstW; x++) {
+      ContributionInfoFixed *contribution = &table->weights[x * table->max_n];
+      int n = table->counts[x];
       fixed_t weight;
-      fixed_t red = 0, green = 0, blue = 0, alpha = 0;
+      int64_t red = 0, green = 0, blue = 0, alpha = 0;
       pix p;
-      int j;
       register int i;
 
-      //DEBUG_TRACE("y %d:\n", y);
-
       if (im->has_alpha) {
-        fixed_t normalize = 0;
+        fixed_t normalize;
 
         for (i = 0; i < n; i++) {
-          j = (int)((y * source->columns) + contribution[i].pixel);
           weight = contribution[i].weight;
-          p = source->buf[j];
+          p = row[contribution[i].pixel];
 
           // XXX The original GM code weighted based on transparency for some reason,
           // but this produces bad results, so we use only the weight
           //transparency_coeff = weight * ((float)COL_ALPHA(p) / 255);
 
           /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d %d) weight %.2f\n",
-            x, contribution[i].pixel, j,
+          DEBUG_TRACE("    merging with pix (%d, %d) (%d %d %d %d) weight %.2f\n",
+            contribution[i].pixel, y,
             COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p),
             fixed_to_float(weight));
           */
 
-          red   += fixed_mul(weight, int_to_fixed(COL_RED(p)));
-          green += fixed_mul(weight, int_to_fixed(COL_GREEN(p)));
-          blue  += fixed_mul(weight, int_to_fixed(COL_BLUE(p)));
-          alpha += fixed_mul(weight, int_to_fixed(COL_ALPHA(p)));
-          normalize += weight;
+          red   += (int64_t)weight * COL_RED(p);
+          green += (int64_t)weight * COL_GREEN(p);
+          blue  += (int64_t)weight * COL_BLUE(p);
+          alpha += (int64_t)weight * COL_ALPHA(p);
         }
 
-        normalize = fixed_div(FIXED_1, (ABS(normalize) <= FIXED_EPSILON ? FIXED_1 : normalize));
-        red   = fixed_mul(red, normalize);
-        green = fixed_mul(green, normalize);
-        blue  = fixed_mul(blue, normalize);
+        normalize = table->normalize[x];
+        red   = (red * normalize) >> FRAC_BITS;
+        green = (green * normalize) >> FRAC_BITS;
+        blue  = (blue * normalize) >> FRAC_BITS;
       }
       else {
         for (i = 0; i < n; i++) {
-          j = (int)((y * source->columns) + contribution[i].pixel);
           weight = contribution[i].weight;
-          p = source->buf[j];
+          p = row[contribution[i].pixel];
 
           /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d) weight %.2f\n",
-            contribution[i].pixel, y, j,
+          DEBUG_TRACE("    merging with pix (%d, %d) (%d %d %d) weight %.2f\n",
+            contribution[i].pixel, y,
             COL_RED(p), COL_GREEN(p), COL_BLUE(p),
-            weight);
+            fixed_to_float(weight));
           */
 
-          red   += fixed_mul(weight, int_to_fixed(COL_RED(p)));
-          green += fixed_mul(weight, int_to_fixed(COL_GREEN(p)));
-          blue  += fixed_mul(weight, int_to_fixed(COL_BLUE(p)));
+          red   += (int64_t)weight * COL_RED(p);
+          green += (int64_t)weight * COL_GREEN(p);
+          blue  += (int64_t)weight * COL_BLUE(p);
         }
 
         alpha = FIXED_255;
       }
 
-      /*
-      DEBUG_TRACE("  -> (%d, %d) @ %d (%d %d %d %d)\n",
-        x, y, (y * destination->columns) + x,
-        ROUND_FIXED_TO_INT(red),
-        ROUND_FIXED_TO_INT(green),
-        ROUND_FIXED_TO_INT(blue),
-        ROUND_FIXED_TO_INT(alpha));
-      */
-
-      if (rotate && im->orientation != ORIENTATION_NORMAL) {
-        int ox, oy; // new destination pixel coordinates after rotating
-
-        image_get_rotated_coords(im, x, y, &ox, &oy);
-
-        if (im->orientation >= 5) {
-          // 90 and 270 rotations, width/height are swapped
-          destination->buf[(oy * destination->rows) + ox] = COL_FULL(
-            ROUND_FIXED_TO_INT(red),
-            ROUND_FIXED_TO_INT(green),
-            ROUND_FIXED_TO_INT(blue),
-            ROUND_FIXED_TO_INT(alpha)
-          );
-        }
-        else {
-          destination->buf[(oy * destination->columns) + ox] = COL_FULL(
-            ROUND_FIXED_TO_INT(red),
-            ROUND_FIXED_TO_INT(green),
-            ROUND_FIXED_TO_INT(blue),
-            ROUND_FIXED_TO_INT(alpha)
-          );
+      image_downsize_gm_put_pix(
+        im, destination, x + dstX, y,
+        COL_FULL(ROUND_FIXED_TO_INT(red), ROUND_FIXED_TO_INT(green), ROUND_FIXED_TO_INT(blue), ROUND_FIXED_TO_INT(alpha)),
+        rotate
+      );
+    }
+  }
+}
+
+static void
+image_downsize_gm_vertical_filter_fixed_point_generic(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTableFixed *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstY = im->height_padding; // destination rows start below any padding
+
+  for (y = start; y < end; y++) {
+    ContributionInfoFixed *contribution = &table->weights[y * table->max_n];
+    int n = table->counts[y];
+    fixed_t normalize = im->has_alpha ? table->normalize[y] : FIXED_1;
+
+    for (x = 0; x < destination->columns; x++) {
+      fixed_t weight;
+      int64_t red = 0, green = 0, blue = 0, alpha = 0;
+      pix p;
+      register int i;
+
+      //DEBUG_TRACE("x %d:\n", x);
+
+      if (im->has_alpha) {
+        for (i = 0; i < n; i++) {
+          weight = contribution[i].weight;
+          p = source->buf[(contribution[i].pixel * source->columns) + x];
+
+          /*
+          DEBUG_TRACE("    merging with pix (%d, %d) (%d %d %d %d) weight %.2f\n",
+            x, contribution[i].pixel,
+            COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p),
+            fixed_to_float(weight));
+          */
+
+          red   += (int64_t)weight * COL_RED(p);
+          green += (int64_t)weight * COL_GREEN(p);
+          blue  += (int64_t)weight * COL_BLUE(p);
+          alpha += (int64_t)weight * COL_ALPHA(p);
         }
+
+        red   = (red * normalize) >> FRAC_BITS;
+        green = (green * normalize) >> FRAC_BITS;
+        blue  = (blue * normalize) >> FRAC_BITS;
       }
       else {
-        destination->buf[(y * destination->columns) + x] = COL_FULL(
-          ROUND_FIXED_TO_INT(red),
-          ROUND_FIXED_TO_INT(green),
-          ROUND_FIXED_TO_INT(blue),
-          ROUND_FIXED_TO_INT(alpha)
-        );
+        for (i = 0; i < n; i++) {
+          weight = contribution[i].weight;
+          p = source->buf[(contribution[i].pixel * source->columns) + x];
+
+          red   += (int64_t)weight * COL_RED(p);
+          green += (int64_t)weight * COL_GREEN(p);
+          blue  += (int64_t)weight * COL_BLUE(p);
+        }
+
+        alpha = FIXED_255;
       }
+
+      image_downsize_gm_put_pix(
+        im, destination, x, y + dstY,
+        COL_FULL(ROUND_FIXED_TO_INT(red), ROUND_FIXED_TO_INT(green), ROUND_FIXED_TO_INT(blue), ROUND_FIXED_TO_INT(alpha)),
+        rotate
+      );
     }
   }
 }
 
-static void
-image_downsize_gm_vertical_filter_fixed_point(image *im, ImageInfo *source, ImageInfo *destination,
-  const fixed_t y_factor, const FilterInfoFixed *filter_info, ContributionInfoFixed *contribution, int rotate)
+#ifdef HAVE_SIMD
+// SIMD versions of the filters.  Each pix is expanded to 4 int32 lanes in memory order
+// (alpha, blue, green, red) and accumulated with 32-bit multiplies.  They produce exactly
+// the same output as the generic filters: the table builder flags any table whose
+// weights could overflow 32 bits, and those are handed to the generic versions.  The
+// rounding shift plus saturating packs is equivalent to ROUND_FIXED_TO_INT.
+
+// Used when the rgb channels of an image with alpha need normalizing,
+// acc holds the 4 accumulated channels in memory order
+static inline pix
+image_downsize_gm_finish_pix_fixed(const int32_t *acc, fixed_t normalize)
 {
-  fixed_t scale, support;
-  int y;
-  int dstY = 0;
-  int dstH = destination->rows;
-
-  if (im->height_padding) {
-    dstY = im->height_padding;
-    dstH = im->height_inner;
-  }
+  int64_t red   = ((int64_t)acc[3] * normalize) >> FRAC_BITS;
+  int64_t green = ((int64_t)acc[2] * normalize) >> FRAC_BITS;
+  int64_t blue  = ((int64_t)acc[1] * normalize) >> FRAC_BITS;
 
-  //DEBUG_TRACE("y_factor %.2f\n", y_factor);
+  return COL_FULL(ROUND_FIXED_TO_INT(red), ROUND_FIXED_TO_INT(green), ROUND_FIXED_TO_INT(blue), ROUND_FIXED_TO_INT(acc[0]));
+}
+
+static inline pix TARGET_SSE41
+image_downsize_gm_pack_pix_fixed_sse41(__m128i acc)
+{
+  acc = _mm_srai_epi32( _mm_add_epi32(acc, _mm_set1_epi32(FIXED_HALF)), FRAC_BITS );
+  acc = _mm_packs_epi32(acc, acc);
+  acc = _mm_packus_epi16(acc, acc);
+
+  return (pix)_mm_cvtsi128_si32(acc);
+}
+
+static inline pix TARGET_SSE41
+image_downsize_gm_finish_fixed_sse41(image *im, __m128i acc, fixed_t normalize)
+{
+  if (!im->has_alpha)
+    return image_downsize_gm_pack_pix_fixed_sse41(acc) | 0xFF;
 
-  // Apply filter to resize vertically from source to destination
-  scale = MAX(fixed_div(FIXED_1, y_factor), FIXED_1);
-  support = fixed_mul(scale, filter_info->support);
-  if (support <= FIXED_HALF) {
-    // Reduce to point sampling
-    support = FIXED_HALF + FIXED_EPSILON;
-    scale = FIXED_1;
+  if (normalize != FIXED_1) {
+    int32_t lanes[4];
+
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return image_downsize_gm_finish_pix_fixed(lanes, normalize);
   }
-  scale = fixed_div(FIXED_1, scale);
 
-  for (y = dstY; (y < dstY + dstH); y++) {
-    fixed_t center, density;
-    int n, start, stop, x;
+  return image_downsize_gm_pack_pix_fixed_sse41(acc);
+}
 
-    center  = fixed_div(int_to_fixed(y - dstY) + FIXED_HALF, y_factor);
-    start   = fixed_to_int(MAX(center - support + FIXED_HALF, 0));
-    stop    = fixed_to_int(MIN(center + support + FIXED_HALF, int_to_fixed(source->rows)));
-    density = 0;
+static void TARGET_SSE41
+image_downsize_gm_horizontal_filter_fixed_point_sse41(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTableFixed *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstX = 0;
+  int dstW = destination->columns;
 
-    //DEBUG_TRACE("y %d: center %.2f, start %d, stop %d\n", y, fixed_to_float(center), start, stop);
+  if (table->overflow) {
+    image_downsize_gm_horizontal_filter_fixed_point_generic(im, source, destination, table, rotate, start, end);
+    return;
+  }
 
-    for (n = 0; n < (stop - start); n++) {
-      contribution[n].pixel = start + n;
-      contribution[n].weight = filter_info->function(fixed_mul(scale, (int_to_fixed(start) + int_to_fixed(n) - center + FIXED_HALF)), filter_info->support);
-      density += contribution[n].weight;
-      //DEBUG_TRACE("  contribution[%d].pixel %d, weight %.2f, density %.2f\n", n, contribution[n].pixel, contribution[n].weight, density);
-    }
+  if (im->width_padding) {
+    dstX = im->width_padding;
+    dstW = im->width_inner;
+  }
 
-    if ((density != 0) && (density != FIXED_1)) {
-      // Normalize
+  for (y = start; y < end; y++) {
+    pix *row = &source->buf[y * source->columns];
+
+    for (x = 0; x < dstW; x++) {
+      ContributionInfoFixed *contribution = &table->weights[x * table->max_n];
+      int n = table->counts[x];
+      __m128i acc = _mm_setzero_si128();
       int i;
 
-      density = fixed_div(FIXED_1, density);
       for (i = 0; i < n; i++) {
-        contribution[i].weight = fixed_mul(contribution[i].weight, density);
-        //DEBUG_TRACE("  normalize contribution[%d].weight to %.2f\n", i, fixed_to_float(contribution[i].weight));
+        __m128i p = _mm_cvtepu8_epi32( _mm_cvtsi32_si128(row[contribution[i].pixel]) );
+        acc = _mm_add_epi32(acc, _mm_mullo_epi32(p, _mm_set1_epi32(contribution[i].weight)));
       }
+
+      image_downsize_gm_put_pix(
+        im, destination, x + dstX, y, image_downsize_gm_finish_fixed_sse41(im, acc, table->normalize[x]), rotate
+      );
     }
+  }
 
-    for (x = 0; x < destination->columns; x++) {
-      fixed_t weight;
-      fixed_t red = 0, green = 0, blue = 0, alpha = 0;
-      pix p;
-      int j;
-      register int i;
+}
 
-      //DEBUG_TRACE("x %d:\n", x);
+// 4 destination pixels are filtered at a time
+static void TARGET_SSE41
+image_downsize_gm_vertical_filter_fixed_point_sse41(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTableFixed *table, int rotate, int start, int end)
+{
+  int x, y, i;
+  int dstY = im->height_padding; // destination rows start below any padding
+  const __m128i half = _mm_set1_epi32(FIXED_HALF);
+  const __m128i opaque = _mm_set1_epi32(0xFF);
+
+  if (table->overflow) {
+    image_downsize_gm_vertical_filter_fixed_point_generic(im, source, destination, table, rotate, start, end);
+    return;
+  }
 
-      if (im->has_alpha) {
-        fixed_t normalize = 0;
+  for (y = start; y < end; y++) {
+    ContributionInfoFixed *contribution = &table->weights[y * table->max_n];
+    int n = table->counts[y];
+    fixed_t normalize = im->has_alpha ? table->normalize[y] : FIXED_1;
 
-        for (i = 0; i < n; i++) {
-          j = (int)((contribution[i].pixel * source->columns) + x);
-          weight = contribution[i].weight;
-          p = source->buf[j];
+    for (x = 0; x + 4 <= destination->columns; x += 4) {
+      __m128i acc[4];
+      pix cols[4];
+      int j;
 
-          // XXX The original GM code weighted based on transparency for some reason,
-          // but this produces bad results, so we use only the weight
-          //transparency_coeff = weight * ((float)COL_ALPHA(p) / 255);
+      acc[0] = acc[1] = acc[2] = acc[3] = _mm_setzero_si128();
 
-          /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d %d) weight %.2f\n",
-            x, contribution[i].pixel, j,
-            COL_RED(p), COL_GREEN(p), COL_BLUE(p), COL_ALPHA(p),
-            fixed_to_float(weight));
-          */
+      for (i = 0; i < n; i++) {
+        __m128i v = _mm_loadu_si128( (__m128i *)&source->buf[(contribution[i].pixel * source->columns) + x] );
+        __m128i weight = _mm_set1_epi32(contribution[i].weight);
 
-          red   += fixed_mul(weight, int_to_fixed(COL_RED(p)));
-          green += fixed_mul(weight, int_to_fixed(COL_GREEN(p)));
-          blue  += fixed_mul(weight, int_to_fixed(COL_BLUE(p)));
-          alpha += fixed_mul(weight, int_to_fixed(COL_ALPHA(p)));
-          normalize += weight;
-        }
+        acc[0] = _mm_add_epi32(acc[0], _mm_mullo_epi32( _mm_cvtepu8_epi32(v), weight ));
+        acc[1] = _mm_add_epi32(acc[1], _mm_mullo_epi32( _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)), weight ));
+        acc[2] = _mm_add_epi32(acc[2], _mm_mullo_epi32( _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)), weight ));
+        acc[3] = _mm_add_epi32(acc[3], _mm_mullo_epi32( _mm_cvtepu8_epi32(_mm_srli_si128(v, 12)), weight ));
+      }
 
-        normalize = fixed_div(FIXED_1, (ABS(normalize) <= FIXED_EPSILON ? FIXED_1 : normalize));
-        red   = fixed_mul(red, normalize);
-        green = fixed_mul(green, normalize);
-        blue  = fixed_mul(blue, normalize);
+      if (normalize != FIXED_1) {
+        for (j = 0; j < 4; j++)
+          cols[j] = image_downsize_gm_finish_fixed_sse41(im, acc[j], normalize);
       }
       else {
-        for (i = 0; i < n; i++) {
-          j = (int)((contribution[i].pixel * source->columns) + x);
-          weight = contribution[i].weight;
-          p = source->buf[j];
+        __m128i out = _mm_packus_epi16(
+          _mm_packs_epi32( _mm_srai_epi32(_mm_add_epi32(acc[0], half), FRAC_BITS),
+                           _mm_srai_epi32(_mm_add_epi32(acc[1], half), FRAC_BITS) ),
+          _mm_packs_epi32( _mm_srai_epi32(_mm_add_epi32(acc[2], half), FRAC_BITS),
+                           _mm_srai_epi32(_mm_add_epi32(acc[3], half), FRAC_BITS) )
+        );
 
-          /*
-          DEBUG_TRACE("    merging with pix (%d, %d) @ %d (%d %d %d) weight %.2f\n",
-            x, contribution[i].pixel, j,
-            COL_RED(p), COL_GREEN(p), COL_BLUE(p),
-            fixed_to_float(weight));
-          */
+        if (!im->has_alpha)
+          out = _mm_or_si128(out, opaque);
 
-          red   += fixed_mul(weight, int_to_fixed(COL_RED(p)));
-          green += fixed_mul(weight, int_to_fixed(COL_GREEN(p)));
-          blue  += fixed_mul(weight, int_to_fixed(COL_BLUE(p)));
+        if ( !(rotate && im->orientation != ORIENTATION_NORMAL) ) {
+          _mm_storeu_si128((__m128i *)&destination->buf[((y + dstY) * destination->columns) + x], out);
+          continue;
         }
 
-        alpha = FIXED_255;
+        _mm_storeu_si128((__m128i *)cols, out);
       }
 
-      /*
-      DEBUG_TRACE("  -> (%d, %d) @ %d (%d %d %d %d)\n",
-        x, y, (y * destination->columns) + x,
-        ROUND_FIXED_TO_INT(red),
-        ROUND_FIXED_TO_INT(green),
-        ROUND_FIXED_TO_INT(blue),
-        ROUND_FIXED_TO_INT(alpha));
-      */
-
-      if (rotate && im->orientation != ORIENTATION_NORMAL) {
-        int ox, oy; // new destination pixel coordinates after rotating
-
-        image_get_rotated_coords(im, x, y, &ox, &oy);
-
-        if (im->orientation >= 5) {
-          // 90 and 270 rotations, width/height are swapped
-          destination->buf[(oy * destination->rows) + ox] = COL_FULL(
-            ROUND_FIXED_TO_INT(red),
-            ROUND_FIXED_TO_INT(green),
-            ROUND_FIXED_TO_INT(blue),
-            ROUND_FIXED_TO_INT(alpha)
-          );
-        }
-        else {
-          destination->buf[(oy * destination->columns) + ox] = COL_FULL(
-            ROUND_FIXED_TO_INT(red),
-            ROUND_FIXED_TO_INT(green),
-            ROUND_FIXED_TO_INT(blue),
-            ROUND_FIXED_TO_INT(alpha)
-          );
-        }
+      for (j = 0; j < 4; j++)
+        image_downsize_gm_put_pix(im, destination, x + j, y + dstY, cols[j], rotate);
+    }
+
+    // Remaining pixels one at a time
+    for ( ; x < destination->columns; x++) {
+      __m128i acc = _mm_setzero_si128();
+
+      for (i = 0; i < n; i++) {
+        __m128i p = _mm_cvtepu8_epi32( _mm_cvtsi32_si128(source->buf[(contribution[i].pixel * source->columns) + x]) );
+        acc = _mm_add_epi32(acc, _mm_mullo_epi32(p, _mm_set1_epi32(contribution[i].weight)));
+      }
+
+      image_downsize_gm_put_pix(
+        im, destination, x, y + dstY, image_downsize_gm_finish_fixed_sse41(im, acc, normalize), rotate
+      );
+    }
+  }
+}
+
+// The AVX2 horizontal filter merges two adjacent source pixels per multiply
+static void TARGET_AVX2
+image_downsize_gm_horizontal_filter_fixed_point_avx2(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTableFixed *table, int rotate, int start, int end)
+{
+  int x, y;
+  int dstX = 0;
+  int dstW = destination->columns;
+
+  if (table->overflow) {
+    image_downsize_gm_horizontal_filter_fixed_point_generic(im, source, destination, table, rotate, start, end);
+    return;
+  }
+
+  if (im->width_padding) {
+    dstX = im->width_padding;
+    dstW = im->width_inner;
+  }
+
+  for (y = start; y < end; y++) {
+    pix *row = &source->buf[y * source->columns];
+
+    for (x = 0; x < dstW; x++) {
+      ContributionInfoFixed *contribution = &table->weights[x * table->max_n];
+      int n = table->counts[x];
+      pix *p = n ? row + contribution[0].pixel : row; // the source pixels are adjacent
+      __m256i acc256 = _mm256_setzero_si256();
+      __m128i acc;
+      int i;
+
+      for (i = 0; i + 1 < n; i += 2) {
+        __m256i px = _mm256_cvtepu8_epi32( _mm_loadl_epi64((__m128i *)(p + i)) );
+        __m256i weight = _mm256_inserti128_si256(
+          _mm256_castsi128_si256( _mm_set1_epi32(contribution[i].weight) ),
+          _mm_set1_epi32(contribution[i + 1].weight), 1
+        );
+        acc256 = _mm256_add_epi32(acc256, _mm256_mullo_epi32(px, weight));
+      }
+
+      acc = _mm_add_epi32( _mm256_castsi256_si128(acc256), _mm256_extracti128_si256(acc256, 1) );
+
+      if (i < n) {
+        acc = _mm_add_epi32(acc, _mm_mullo_epi32(
+          _mm_cvtepu8_epi32( _mm_cvtsi32_si128(p[i]) ), _mm_set1_epi32(contribution[i].weight)
+        ));
+      }
+
+      image_downsize_gm_put_pix(
+        im, destination, x + dstX, y, image_downsize_gm_finish_fixed_sse41(im, acc, table->normalize[x]), rotate
+      );
+    }
+  }
+
+}
+
+// 8 destination pixels are filtered at a time
+static void TARGET_AVX2
+image_downsize_gm_vertical_filter_fixed_point_avx2(image *im, ImageInfo *source, ImageInfo *destination,
+  const ContributionTableFixed *table, int rotate, int start, int end)
+{
+  int x, y, i;
+  int dstY = im->height_padding; // destination rows start below any padding
+  const __m256i half = _mm256_set1_epi32(FIXED_HALF);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  const __m256i opaque = _mm256_set1_epi32(0xFF);
+
+  if (table->overflow) {
+    image_downsize_gm_vertical_filter_fixed_point_generic(im, source, destination, table, rotate, start, end);
+    return;
+  }
+
+  for (y = start; y < end; y++) {
+    ContributionInfoFixed *contribution = &table->weights[y * table->max_n];
+    int n = table->counts[y];
+    fixed_t normalize = im->has_alpha ? table->normalize[y] : FIXED_1;
+
+    for (x = 0; x + 8 <= destination->columns; x += 8) {
+      __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+      __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+      __m256i out;
+      pix cols[8];
+      int j;
+
+      for (i = 0; i < n; i++) {
+        __m256i v = _mm256_loadu_si256( (__m256i *)&source->buf[(contribution[i].pixel * source->columns) + x] );
+        __m128i lo = _mm256_castsi256_si128(v);
+        __m128i hi = _mm256_extracti128_si256(v, 1);
+        __m256i weight = _mm256_set1_epi32(contribution[i].weight);
+
+        acc0 = _mm256_add_epi32(acc0, _mm256_mullo_epi32( _mm256_cvtepu8_epi32(lo), weight ));
+        acc1 = _mm256_add_epi32(acc1, _mm256_mullo_epi32( _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)), weight ));
+        acc2 = _mm256_add_epi32(acc2, _mm256_mullo_epi32( _mm256_cvtepu8_epi32(hi), weight ));
+        acc3 = _mm256_add_epi32(acc3, _mm256_mullo_epi32( _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)), weight ));
+      }
+
+      if (normalize != FIXED_1) {
+        int32_t lanes[32];
+
+        _mm256_storeu_si256((__m256i *)&lanes[0], acc0);
+        _mm256_storeu_si256((__m256i *)&lanes[8], acc1);
+        _mm256_storeu_si256((__m256i *)&lanes[16], acc2);
+        _mm256_storeu_si256((__m256i *)&lanes[24], acc3);
+
+        for (j = 0; j < 8; j++)
+          cols[j] = image_downsize_gm_finish_pix_fixed(&lanes[j * 4], normalize);
       }
       else {
-        destination->buf[(y * destination->columns) + x] = COL_FULL(
-          ROUND_FIXED_TO_INT(red),
-          ROUND_FIXED_TO_INT(green),
-          ROUND_FIXED_TO_INT(blue),
-          ROUND_FIXED_TO_INT(alpha)
+        // Packing works within each 128-bit lane, leaving the pixels in the order 0 2 4 6 1 3 5 7
+        out = _mm256_packus_epi16(
+          _mm256_packs_epi32( _mm256_srai_epi32(_mm256_add_epi32(acc0, half), FRAC_BITS),
+                              _mm256_srai_epi32(_mm256_add_epi32(acc1, half), FRAC_BITS) ),
+          _mm256_packs_epi32( _mm256_srai_epi32(_mm256_add_epi32(acc2, half), FRAC_BITS),
+                              _mm256_srai_epi32(_mm256_add_epi32(acc3, half), FRAC_BITS) )
         );
+        out = _mm256_permutevar8x32_epi32(out, order);
+
+        if (!im->has_alpha)
+          out = _mm256_or_si256(out, opaque);
+
+        if ( !(rotate && im->orientation != ORIENTATION_NORMAL) ) {
+          _mm256_storeu_si256((__m256i *)&destination->buf[((y + dstY) * destination->columns) + x], out);
+          continue;
+        }
+
+        _mm256_storeu_si256((__m256i *)cols, out);
+      }
+
+      for (j = 0; j < 8; j++)
+        image_downsize_gm_put_pix(im, destination, x + j, y + dstY, cols[j], rotate);
+    }
+
+    // Remaining pixels one at a time
+    for ( ; x < destination->columns; x++) {
+      __m128i acc = _mm_setzero_si128();
+
+      for (i = 0; i < n; i++) {
+        __m128i p = _mm_cvtepu8_epi32( _mm_cvtsi32_si128(source->buf[(contribution[i].pixel * source->columns) + x]) );
+        acc = _mm_add_epi32(acc, _mm_mullo_epi32(p, _mm_set1_epi32(contribution[i].weight)));
       }
+
+      image_downsize_gm_put_pix(
+        im, destination, x, y + dstY, image_downsize_gm_finish_fixed_sse41(im, acc, normalize), rotate
+      );
     }
   }
 }
+#endif
+
+static void
+image_downsize_gm_horizontal_job_fixed_point(image *im, void *arg, int part, int start, int end)
+{
+  FilterPass *pass = (FilterPass *)arg;
+
+  simd->gm_horizontal_filter_fixed_point(im, pass->source, pass->destination, pass->table_fixed, pass->rotate, start, end);
+}
+
+static void
+image_downsize_gm_vertical_job_fixed_point(image *im, void *arg, int part, int start, int end)
+{
+  FilterPass *pass = (FilterPass *)arg;
+
+  simd->gm_vertical_filter_fixed_point(im, pass->source, pass->destination, pass->table_fixed, pass->rotate, start, end);
+}
 
 void
 image_downsize_gm_fixed_point(image *im)
 {
   // This intentionally still uses floating-point because these variables are only calculated once
   float x_factor, y_factor;
-  float support, x_support, y_support;
   int columns, rows;
   int order;
+  int dstH = im->height_padding ? im->height_inner : im->target_height;
   int filter;
-  ContributionInfoFixed *contribution;
+  ContributionTableFixed x_table, y_table;
   ImageInfo source, destination;
-
-  static const FilterInfoFixed
-    filters[SincFilter+1] =
-    {
-      { BoxFixed, 0 },
-      { BoxFixed, 0 },
-      { BoxFixed, FIXED_HALF },
-      { TriangleFixed, FIXED_1 },
-      // Triangle seems good enough
-    };
+  FilterPass horizontal, vertical;
 
   columns = im->target_width;
   rows = im->target_height;
-  filter = TriangleFilter; // Force Triangle for fixed-point mode, best quality and performance
+  filter = im->filter;
+
+  if (!filter) {
+    // Triangle seems good enough, best quality and performance in fixed-point mode
+    filter = TriangleFilter;
+  }
 
   DEBUG_TRACE("Resizing with filter %d\n", filter);
 
@@ -372,31 +659,34 @@ image_downsize_gm_fixed_point(image *im)
   order = (((float)columns * (im->height + rows)) >
          ((float)rows * (im->width + columns)));
 
-   if (im->width_padding)
-     x_factor = (float)im->width_inner / im->width;
-   else
-     x_factor = (float)im->target_width / im->width;
-
-   if (im->height_padding)
-     y_factor = (float)im->height_inner / im->height;
-   else
-     y_factor = (float)im->target_height / im->height;
+  if (im->width_padding)
+    x_factor = (float)im->width_inner / im->width;
+  else
+    x_factor = (float)im->target_width / im->width;
 
-  x_support = BLUR * MAX(1.0 / x_factor, 1.0) * fixed_to_int(filters[filter].support);
-  y_support = BLUR * MAX(1.0 / y_factor, 1.0) * fixed_to_int(filters[filter].support);
-  support = MAX(x_support, y_support);
-  if (support < fixed_to_int(filters[filter].support))
-    support = fixed_to_int(filters[filter].support);
+  if (im->height_padding)
+    y_factor = (float)im->height_inner / im->height;
+  else
+    y_factor = (float)im->target_height / im->height;
 
-  DEBUG_TRACE("ContributionInfoFixed allocated for %ld items\n", (size_t)(2.0 * MAX(support, 0.5) + 3));
-  New(0, contribution, (size_t)(2.0 * MAX(support, 0.5) + 3), ContributionInfoFixed);
+  DEBUG_TRACE("order %d, x_factor %f, y_factor %f\n", order, x_factor, y_factor);
 
-  DEBUG_TRACE("order %d, x_factor %f, y_factor %f, support %f\n", order, x_factor, y_factor, support);
+  image_downsize_gm_contributions_fixed_point(
+    &x_table, filter, x_factor, im->width, im->width_padding ? im->width_inner : im->target_width
+  );
+  image_downsize_gm_contributions_fixed_point(
+    &y_table, filter, y_factor, im->height, dstH
+  );
 
   source.rows    = im->height;
   source.columns = im->width;
   source.buf     = im->pixbuf;
 
+  horizontal.source      = vertical.source      = &source;
+  horizontal.destination = vertical.destination = &destination;
+  horizontal.table_fixed = &x_table;
+  vertical.table_fixed   = &y_table;
+
   if (order) {
     DEBUG_TRACE("Allocating temporary buffer size %ld\n", im->target_width * im->height * sizeof(pix));
     New(0, im->tmpbuf, im->target_width * im->height, pix);
@@ -408,7 +698,8 @@ image_downsize_gm_fixed_point(image *im)
     destination.rows    = im->height;
     destination.columns = im->target_width;
     destination.buf     = im->tmpbuf;
-    image_downsize_gm_horizontal_filter_fixed_point(im, &source, &destination, float_to_fixed(x_factor), &filters[filter], contribution, 0);
+    horizontal.rotate = 0;
+    image_pool_run(im, destination.rows, image_downsize_gm_horizontal_job_fixed_point, &horizontal);
 
     // Resize vertically from tmp -> out
     source.rows    = destination.rows;
@@ -417,7 +708,8 @@ image_downsize_gm_fixed_point(image *im)
 
     destination.rows = im->target_height;
     destination.buf  = im->outbuf;
-    image_downsize_gm_vertical_filter_fixed_point(im, &source, &destination, float_to_fixed(y_factor), &filters[filter], contribution, 1);
+    vertical.rotate = 1;
+    image_pool_run(im, dstH, image_downsize_gm_vertical_job_fixed_point, &vertical);
   }
   else {
     DEBUG_TRACE("Allocating temporary buffer size %ld\n", im->width * im->target_height * sizeof(pix));
@@ -430,7 +722,8 @@ image_downsize_gm_fixed_point(image *im)
     destination.rows    = im->target_height;
     destination.columns = im->width;
     destination.buf     = im->tmpbuf;
-    image_downsize_gm_vertical_filter_fixed_point(im, &source, &destination, float_to_fixed(y_factor), &filters[filter], contribution, 0);
+    vertical.rotate = 0;
+    image_pool_run(im, dstH, image_downsize_gm_vertical_job_fixed_point, &vertical);
 
     // Resize horizontally from tmp -> out
     source.rows    = destination.rows;
@@ -439,9 +732,11 @@ image_downsize_gm_fixed_point(image *im)
 
     destination.columns = im->target_width;
     destination.buf     = im->outbuf;
-    image_downsize_gm_horizontal_filter_fixed_point(im, &source, &destination, float_to_fixed(x_factor), &filters[filter], contribution, 1);
+    horizontal.rotate = 1;
+    image_pool_run(im, destination.rows, image_downsize_gm_horizontal_job_fixed_point, &horizontal);
   }
 
   Safefree(im->tmpbuf);
-  Safefree(contribution);
+  image_downsize_gm_contributions_fixed_point_free(&x_table);
+  image_downsize_gm_contributions_fixed_point_free(&y_table);
 }
@@ -25,24 +25,20 @@ image_png_read_buf(png_structp png_ptr, png_bytep data, png_size_t len)
    if ( !_check_buf(im->fh, im->buf, len, MAX(len, BUFFER_SIZE)) ) {
      goto eof;
    }
+
+   memcpy(data, buffer_ptr(im->buf), len);
+   buffer_consume(im->buf, len);
  }
  else {
-   if (len > buffer_len(im->buf)) {
-     // read from SV into buffer
-     int sv_readlen = len - buffer_len(im->buf);
-
-     if (sv_readlen > sv_len(im->sv_data) - im->sv_offset)
-       goto eof;
+   // Copy straight from the scalar or mapped file
+   if (len > image_data_len(im) - im->sv_offset)
+     goto eof;
 
-     DEBUG_TRACE("  Reading %d bytes of SV data @ %d\n", sv_readlen, im->sv_offset);
-     buffer_append(im->buf, SvPVX(im->sv_data) + im->sv_offset, sv_readlen);
-     im->sv_offset += sv_readlen;
-    }
+   DEBUG_TRACE("  Reading %ld bytes of SV data @ %d\n", len, im->sv_offset);
+   memcpy(data, image_data_ptr(im) + im->sv_offset, len);
+   im->sv_offset += len;
  }
 
- memcpy(data, buffer_ptr(im->buf), len);
- buffer_consume(im->buf, len);
-
  goto ok;
 
 eof:
@@ -88,6 +84,12 @@ image_png_read_header(image *im)
     return 0;
   }
 
+  if (im->fh == NULL) {
+    // Start over from the in-memory data, image_png_read_buf() does not use the copy in im->buf
+    buffer_clear(im->buf);
+    im->sv_offset = im->image_offset;
+  }
+
   png_set_read_fn(im->png_ptr, im, image_png_read_buf);
 
   png_read_info(im->png_ptr, im->info_ptr);
@@ -95,59 +97,50 @@ image_png_read_header(image *im)
   im->width     = png_get_image_width(im->png_ptr, im->info_ptr);
   im->height    = png_get_image_height(im->png_ptr, im->info_ptr);
   im->channels  = png_get_channels(im->png_ptr, im->info_ptr);
-  im->has_alpha = 1;
+
+  // Cleared by image_png_load() if no pixel turns out to be transparent
+  im->has_alpha = (png_get_color_type(im->png_ptr, im->info_ptr) & PNG_COLOR_MASK_ALPHA)
+    || png_get_valid(im->png_ptr, im->info_ptr, PNG_INFO_tRNS);
 
   return 1;
 }
 
-static void
-image_png_interlace_pass_gray(image *im, unsigned char *ptr, int start_y, int stride_y, int start_x, int stride_x)
+// Adam7 passes: first column, first row, column step, row step
+static const int adam7[7][4] = {
+  { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+  { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+};
+
+// The first 1, 3 or 5 passes of an interlaced image hold every 8th, 4th or 2nd pixel
+// in both directions, so like JPEG DCT scaling only those need to be decoded for a
+// small enough target.  Returns the largest step whose reduced image is still at least
+// the target size, or 1 if all passes are needed
+static int
+image_png_interlace_step(image *im)
 {
-  int x, y;
-
-  for (y = 0; y < im->height; y++) {
-    png_read_row(im->png_ptr, ptr, NULL);
-    if (start_y == 0) {
-      start_y = stride_y;
-      for (x = start_x; x < im->width; x += stride_x) {
-        im->pixbuf[y * im->width + x] = COL_FULL(
-          ptr[x * 2], ptr[x * 2], ptr[x * 2], ptr[x * 2 + 1]
-        );
-      }
-    }
-    start_y--;
-  }
-}
+  int step;
 
-static void
-image_png_interlace_pass(image *im, unsigned char *ptr, int start_y, int stride_y, int start_x, int stride_x)
-{
-  int x, y;
-
-  for (y = 0; y < im->height; y++) {
-    png_read_row(im->png_ptr, ptr, NULL);
-    if (start_y == 0) {
-      start_y = stride_y;
-      for (x = start_x; x < im->width; x += stride_x) {
-        im->pixbuf[y * im->width + x] = COL_FULL(
-          ptr[x * 4], ptr[x * 4 + 1], ptr[x * 4 + 2], ptr[x * 4 + 3]
-        );
-      }
-    }
-    start_y--;
+  for (step = 8; step > 1; step /= 2) {
+    if ( (im->width + step - 1) / step >= im->target_width && (im->height + step - 1) / step >= im->target_height )
+      return step;
   }
+
+  return 1;
 }
 
 int
 image_png_load(image *im)
 {
-  int bit_depth, color_type, num_passes, x, y;
-  int ofs;
-  volatile unsigned char *ptr = NULL; // volatile = won't be rolled back if longjmp is called
+  int bit_depth, color_type, num_passes, step, x, y;
+  int opaque = 1;
+  volatile png_bytepp rows = NULL; // volatile = won't be rolled back if longjmp is called
+  volatile pix *row = NULL;
 
   if ( setjmp( png_jmpbuf(im->png_ptr) ) ) {
-    if (ptr != NULL)
-      Safefree(ptr);
+    if (rows != NULL)
+      Safefree(rows);
+    if (row != NULL)
+      Safefree(row);
     image_png_finish(im);
     return 0;
   }
@@ -188,87 +181,121 @@ image_png_load(image *im)
   else if (bit_depth < 8)
     png_set_packing(im->png_ptr);
 
-  // Make non-alpha RGB/Palette 32-bit and Gray 16-bit for easier handling
-  if ( !(color_type & PNG_COLOR_MASK_ALPHA) ) {
+  // Have libpng produce pix directly, gray is expanded to RGB
+  if ( !(color_type & PNG_COLOR_MASK_COLOR) )
+    png_set_gray_to_rgb(im->png_ptr);
+
+#if BYTEORDER == 0x1234 || BYTEORDER == 0x12345678
+  // pix is ABGR in memory
+  png_set_bgr(im->png_ptr);
+
+  if ( (color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(im->png_ptr, im->info_ptr, PNG_INFO_tRNS) )
+    png_set_swap_alpha(im->png_ptr);
+  else
+    png_set_add_alpha(im->png_ptr, 0xFF, PNG_FILLER_BEFORE);
+#else
+  // pix is RGBA in memory
+  if ( !(color_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(im->png_ptr, im->info_ptr, PNG_INFO_tRNS) )
     png_set_add_alpha(im->png_ptr, 0xFF, PNG_FILLER_AFTER);
-  }
+#endif
 
-  num_passes = png_set_interlace_handling(im->png_ptr);
+  step = 1;
+  if (png_get_interlace_type(im->png_ptr, im->info_ptr) == PNG_INTERLACE_ADAM7)
+    step = image_png_interlace_step(im);
 
-  DEBUG_TRACE("png bit_depth %d, color_type %d, channels %d, num_passes %d\n", bit_depth, color_type, im->channels, num_passes);
+  // For a reduced image the passes are read as separate images
+  num_passes = step > 1 ? 7 : png_set_interlace_handling(im->png_ptr);
+
+  DEBUG_TRACE("png bit_depth %d, color_type %d, channels %d, num_passes %d, step %d\n", bit_depth, color_type, im->channels, num_passes, step);
 
   png_read_update_info(im->png_ptr, im->info_ptr);
 
-  image_alloc(im, im->width, im->height);
+  if (step > 1) {
+    int width  = im->width;
+    int height = im->height;
+    int pass;
+
+    im->width  = (width + step - 1) / step;
+    im->height = (height + step - 1) / step;
 
-  New(0, ptr, png_get_rowbytes(im->png_ptr, im->info_ptr), unsigned char);
+    // png_read_row() copies a row of the full image width even when reading a pass
+    New(0, row, width, pix);
 
-  ofs = 0;
+    if (step == 8) {
+      // The first pass is the reduced image, and can be streamed
+      image_alloc_rows(im, im->width, im->height);
 
-  if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) { // Grayscale (Alpha)
-    if (num_passes == 1) { // Non-interlaced
       for (y = 0; y < im->height; y++) {
-        png_read_row(im->png_ptr, (unsigned char *)ptr, NULL);
-        for (x = 0; x < im->width; x++) {
-  			  im->pixbuf[ofs++] = COL_FULL(ptr[x * 2], ptr[x * 2], ptr[x * 2], ptr[x * 2 + 1]);
-  			}
+        png_read_row(im->png_ptr, (png_bytep)row, NULL);
+        Copy(row, image_load_row(im, y), im->width, pix);
+
+        if (im->has_alpha && opaque)
+          opaque = image_pix_opaque((pix *)row, im->width);
       }
     }
-    else if (num_passes == 7) { // Interlaced
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 0, 8, 0, 8);
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 0, 8, 4, 8);
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 4, 8, 0, 4);
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 0, 4, 2, 4);
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 2, 4, 0, 2);
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 0, 2, 1, 2);
-      image_png_interlace_pass_gray(im, (unsigned char *)ptr, 1, 2, 0, 1);
-    }
-  }
-  else { // RGB(A)
-    if (num_passes == 1) { // Non-interlaced
-      for (y = 0; y < im->height; y++) {
-        png_read_row(im->png_ptr, (unsigned char *)ptr, NULL);
-        for (x = 0; x < im->width; x++) {
-  			  im->pixbuf[ofs++] = COL_FULL(ptr[x * 4], ptr[x * 4 + 1], ptr[x * 4 + 2], ptr[x * 4 + 3]);
-  			}
+    else {
+      image_alloc(im, im->width, im->height);
+
+      // Every pixel of the passes before the first one starting off the reduced grid is
+      // on it, the rest of the image data is never read
+      for (pass = 0; adam7[pass][0] % step == 0 && adam7[pass][1] % step == 0; pass++) {
+        int x0 = adam7[pass][0], y0 = adam7[pass][1], dx = adam7[pass][2], dy = adam7[pass][3];
+
+        // libpng skips empty passes of very small images
+        if (width <= x0 || height <= y0)
+          continue;
+
+        for (y = y0; y < height; y += dy) {
+          pix *dst = im->pixbuf + (y / step) * im->width;
+
+          png_read_row(im->png_ptr, (png_bytep)row, NULL);
+          for (x = x0; x < width; x += dx)
+            dst[x / step] = row[(x - x0) / dx];
+        }
       }
+
+      if (im->has_alpha)
+        opaque = image_pix_opaque(im->pixbuf, im->width * im->height);
     }
-    else if (num_passes == 7) { // Interlaced
-      // The first pass will return an image 1/8 as wide as the entire image
-      // (every 8th column starting in column 0)
-      // and 1/8 as high as the original (every 8th row starting in row 0)
-      image_png_interlace_pass(im, (unsigned char *)ptr, 0, 8, 0, 8);
-
-      // The second will be 1/8 as wide (starting in column 4)
-      // and 1/8 as high (also starting in row 0)
-      image_png_interlace_pass(im, (unsigned char *)ptr, 0, 8, 4, 8);
-
-      // The third pass will be 1/4 as wide (every 4th pixel starting in column 0)
-      // and 1/8 as high (every 8th row starting in row 4)
-      image_png_interlace_pass(im, (unsigned char *)ptr, 4, 8, 0, 4);
-
-      // The fourth pass will be 1/4 as wide and 1/4 as high
-      // (every 4th column starting in column 2, and every 4th row starting in row 0)
-      image_png_interlace_pass(im, (unsigned char *)ptr, 0, 4, 2, 4);
-
-      // The fifth pass will return an image 1/2 as wide,
-      // and 1/4 as high (starting at column 0 and row 2)
-      image_png_interlace_pass(im, (unsigned char *)ptr, 2, 4, 0, 2);
-
-      // The sixth pass will be 1/2 as wide and 1/2 as high as the original
-      // (starting in column 1 and row 0)
-      image_png_interlace_pass(im, (unsigned char *)ptr, 0, 2, 1, 2);
-
-      // The seventh pass will be as wide as the original, and 1/2 as high,
-      // containing all of the odd numbered scanlines.
-      image_png_interlace_pass(im, (unsigned char *)ptr, 1, 2, 0, 1);
-    }
-    else {
-      croak("Image::Scale unsupported PNG interlace type (%d passes)\n", num_passes);
+
+    Safefree(row);
+    row = NULL;
+  }
+  else if (num_passes == 1) { // Non-interlaced
+    image_alloc_rows(im, im->width, im->height);
+
+    for (y = 0; y < im->height; y++) {
+      pix *dst = image_load_row(im, y);
+
+      png_read_row(im->png_ptr, (png_bytep)dst, NULL);
+
+      if (im->has_alpha && opaque)
+        opaque = image_pix_opaque(dst, im->width);
     }
   }
+  else { // Interlaced, only complete after the last pass so can't be streamed
+    image_alloc(im, im->width, im->height);
 
-  Safefree(ptr);
+    New(0, rows, im->height, png_bytep);
+    for (y = 0; y < im->height; y++)
+      rows[y] = (png_bytep)(im->pixbuf + y * im->width);
+
+    // libpng combines the passes into the rows
+    png_read_image(im->png_ptr, rows);
+
+    Safefree(rows);
+    rows = NULL;
+
+    if (im->has_alpha)
+      opaque = image_pix_opaque(im->pixbuf, im->width * im->height);
+  }
+
+  // Many images with an alpha channel don't use it, dropping it lets the resize take its
+  // faster opaque path and PNG output be written without alpha
+  if (im->has_alpha && opaque) {
+    DEBUG_TRACE("PNG has no transparent pixels\n");
+    im->has_alpha = 0;
+  }
 
   // This is not required, so we can save some time by not reading post-image chunks
   //png_read_end(im->png_ptr, im->info_ptr);
@@ -276,72 +303,171 @@ image_png_load(image *im)
   return 1;
 }
 
-static void
-image_png_compress(image *im, png_structp png_ptr, png_infop info_ptr)
+// Reads the compression_level, filter and strategy options, and the fast preset
+// which they override.  opts may be NULL for the libpng defaults
+void
+image_png_options_init(image_png_options *o, HV *opts)
 {
-  int i, x, y;
-  int color_space = PNG_COLOR_TYPE_RGB_ALPHA;
-  volatile unsigned char *ptr = NULL;
+  o->level    = -1;
+  o->filters  = -1;
+  o->strategy = -1;
 
-  if (setjmp( png_jmpbuf(png_ptr) )) {
-    if (ptr != NULL)
-      Safefree(ptr);
+  if (opts == NULL)
     return;
+
+  // A single filter skips the per-row search over all 5 filters, and UP at level 1
+  // compressed photos and the test images best of the fast settings, see tools/png_bench.pl
+  if (my_hv_exists(opts, "fast") && SvTRUE(*(my_hv_fetch(opts, "fast")))) {
+    o->level   = 1;
+    o->filters = PNG_FILTER_UP;
+  }
+
+  if (my_hv_exists(opts, "compression_level")) {
+    o->level = SvIV(*(my_hv_fetch(opts, "compression_level")));
+    if (o->level < 0 || o->level > 9)
+      croak("Image::Scale PNG compression_level must be 0-9\n");
+  }
+
+  if (my_hv_exists(opts, "filter")) {
+    char *filterstr = SvPV_nolen(*(my_hv_fetch(opts, "filter")));
+    if (strEQ("none", filterstr))
+      o->filters = PNG_FILTER_NONE;
+    else if (strEQ("sub", filterstr))
+      o->filters = PNG_FILTER_SUB;
+    else if (strEQ("up", filterstr))
+      o->filters = PNG_FILTER_UP;
+    else if (strEQ("avg", filterstr))
+      o->filters = PNG_FILTER_AVG;
+    else if (strEQ("paeth", filterstr))
+      o->filters = PNG_FILTER_PAETH;
+    else if (strEQ("all", filterstr))
+      o->filters = PNG_ALL_FILTERS;
+    else
+      croak("Image::Scale unknown PNG filter %s\n", filterstr);
+  }
+
+  if (my_hv_exists(opts, "strategy")) {
+    char *strategystr = SvPV_nolen(*(my_hv_fetch(opts, "strategy")));
+    if (strEQ("default", strategystr))
+      o->strategy = Z_DEFAULT_STRATEGY;
+    else if (strEQ("filtered", strategystr))
+      o->strategy = Z_FILTERED;
+    else if (strEQ("huffman", strategystr))
+      o->strategy = Z_HUFFMAN_ONLY;
+#ifdef Z_RLE
+    else if (strEQ("rle", strategystr))
+      o->strategy = Z_RLE;
+#endif
+#ifdef Z_FIXED
+    else if (strEQ("fixed", strategystr))
+      o->strategy = Z_FIXED;
+#endif
+    else
+      croak("Image::Scale unknown PNG strategy %s\n", strategystr);
   }
 
+  DEBUG_TRACE("PNG options: level %d, filters 0x%x, strategy %d\n", o->level, o->filters, o->strategy);
+}
+
+static void
+image_png_compress_start(image *im, png_structp png_ptr, png_infop info_ptr, image_png_options *o)
+{
+  // Alpha is only written if the source has transparent pixels, or keep_aspect
+  // padding is left transparent
+  int alpha = im->has_alpha || (im->keep_aspect && !im->bgcolor);
+  int color_space;
+
   // Match output color space with input file
-  switch (im->channels) {
-    case 4:
-    case 3:
-      DEBUG_TRACE("PNG output color space set to RGBA\n");
-      color_space = PNG_COLOR_TYPE_RGB_ALPHA;
-      break;
-    case 2:
-    case 1:
-      DEBUG_TRACE("PNG output color space set to gray alpha\n");
-      color_space = PNG_COLOR_TYPE_GRAY_ALPHA;
-      break;
+  if ( image_gray_output(im) ) {
+    DEBUG_TRACE("PNG output color space set to gray%s\n", alpha ? " alpha" : "");
+    color_space = alpha ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_GRAY;
+  }
+  else {
+    DEBUG_TRACE("PNG output color space set to RGB%s\n", alpha ? "A" : "");
+    color_space = alpha ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB;
   }
 
   png_set_IHDR(png_ptr, info_ptr, im->target_width, im->target_height, 8, color_space,
     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
+  if (o->level >= 0)
+    png_set_compression_level(png_ptr, o->level);
+
+  if (o->filters >= 0)
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, o->filters);
+
+  if (o->strategy >= 0)
+    png_set_compression_strategy(png_ptr, o->strategy);
+
   png_write_info(png_ptr, info_ptr);
+}
 
-  New(0, ptr, png_get_rowbytes(png_ptr, info_ptr), unsigned char);
+// Compress one row of the resized image, ptr has room for png_get_rowbytes()
+static void
+image_png_compress_row(image *im, png_structp png_ptr, png_infop info_ptr, pix *row, unsigned char *ptr)
+{
+  int x;
 
-  i = 0;
+  switch (png_get_color_type(png_ptr, info_ptr)) {
+    case PNG_COLOR_TYPE_GRAY:
+      for (x = 0; x < im->target_width; x++)
+        ptr[x] = COL_BLUE(row[x]);
+      break;
 
-  if (color_space == PNG_COLOR_TYPE_GRAY_ALPHA) {
-    for (y = 0; y < im->target_height; y++) {
+    case PNG_COLOR_TYPE_GRAY_ALPHA:
       for (x = 0; x < im->target_width; x++)  {
-        ptr[x * 2]     = COL_BLUE(im->outbuf[i]);
-        ptr[x * 2 + 1] = COL_ALPHA(im->outbuf[i]);
-        i++;
+        ptr[x * 2]     = COL_BLUE(row[x]);
+        ptr[x * 2 + 1] = COL_ALPHA(row[x]);
       }
-      png_write_row(png_ptr, (png_bytep)ptr);
-    }
-  }
-  else { // RGB
-    for (y = 0; y < im->target_height; y++) {
+      break;
+
+    case PNG_COLOR_TYPE_RGB:
       for (x = 0; x < im->target_width; x++)  {
-        ptr[x * 4]     = COL_RED(im->outbuf[i]);
-        ptr[x * 4 + 1] = COL_GREEN(im->outbuf[i]);
-        ptr[x * 4 + 2] = COL_BLUE(im->outbuf[i]);
-        ptr[x * 4 + 3] = COL_ALPHA(im->outbuf[i]);
-        i++;
+        ptr[x * 3]     = COL_RED(row[x]);
+        ptr[x * 3 + 1] = COL_GREEN(row[x]);
+        ptr[x * 3 + 2] = COL_BLUE(row[x]);
       }
-      png_write_row(png_ptr, (png_bytep)ptr);
-    }
+      break;
+
+    default: // RGBA
+      for (x = 0; x < im->target_width; x++)  {
+        ptr[x * 4]     = COL_RED(row[x]);
+        ptr[x * 4 + 1] = COL_GREEN(row[x]);
+        ptr[x * 4 + 2] = COL_BLUE(row[x]);
+        ptr[x * 4 + 3] = COL_ALPHA(row[x]);
+      }
+      break;
+  }
+
+  png_write_row(png_ptr, (png_bytep)ptr);
+}
+
+static void
+image_png_compress(image *im, png_structp png_ptr, png_infop info_ptr, image_png_options *o)
+{
+  int y;
+  volatile unsigned char *ptr = NULL;
+
+  if (setjmp( png_jmpbuf(png_ptr) )) {
+    if (ptr != NULL)
+      Safefree(ptr);
+    return;
   }
 
+  image_png_compress_start(im, png_ptr, info_ptr, o);
+
+  New(0, ptr, png_get_rowbytes(png_ptr, info_ptr), unsigned char);
+
+  for (y = 0; y < im->target_height; y++)
+    image_png_compress_row(im, png_ptr, info_ptr, &im->outbuf[y * im->target_width], (unsigned char *)ptr);
+
   Safefree(ptr);
 
   png_write_end(png_ptr, info_ptr);
 }
 
 void
-image_png_save(image *im, const char *path)
+image_png_save(image *im, const char *path, image_png_options *o)
 {
   png_structp png_ptr;
   png_infop info_ptr;
@@ -368,7 +494,7 @@ image_png_save(image *im, const char *path)
 
   png_init_io(png_ptr, out);
 
-  image_png_compress(im, png_ptr, info_ptr);
+  image_png_compress(im, png_ptr, info_ptr, o);
 
   fclose(out);
   png_destroy_write_struct(&png_ptr, &info_ptr);
@@ -392,7 +518,7 @@ image_png_flush_sv(png_structp png_ptr)
 }
 
 void
-image_png_to_sv(image *im, SV *sv_buf)
+image_png_to_sv(image *im, SV *sv_buf, image_png_options *o)
 {
   png_structp png_ptr;
   png_infop info_ptr;
@@ -413,11 +539,66 @@ image_png_to_sv(image *im, SV *sv_buf)
 
   png_set_write_fn(png_ptr, sv_buf, image_png_write_sv, image_png_flush_sv);
 
-  image_png_compress(im, png_ptr, info_ptr);
+  image_png_compress(im, png_ptr, info_ptr, o);
 
   png_destroy_write_struct(&png_ptr, &info_ptr);
 }
 
+// The save_png resize option, see writer.c.  libpng errors longjmp back to the
+// caller of png_write_row(), so each call has its own setjmp
+void
+image_png_write_row(image *im, image_writer *w, pix *row)
+{
+  if (w->failed)
+    return;
+
+  if (w->png_ptr == NULL) {
+    w->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!w->png_ptr)
+      croak("Image::Scale could not initialize libpng\n");
+
+    w->info_ptr = png_create_info_struct(w->png_ptr);
+    if (!w->info_ptr)
+      croak("Image::Scale could not initialize libpng\n");
+
+    if (w->out != NULL)
+      png_init_io(w->png_ptr, w->out);
+    else
+      png_set_write_fn(w->png_ptr, w->sv_buf, image_png_write_sv, image_png_flush_sv);
+
+    if (setjmp( png_jmpbuf(w->png_ptr) )) {
+      w->failed = 1;
+      return;
+    }
+
+    image_png_compress_start(im, w->png_ptr, w->info_ptr, &w->png_options);
+
+    New(0, w->data, png_get_rowbytes(w->png_ptr, w->info_ptr), unsigned char);
+  }
+
+  if (setjmp( png_jmpbuf(w->png_ptr) )) {
+    w->failed = 1;
+    return;
+  }
+
+  image_png_compress_row(im, w->png_ptr, w->info_ptr, row, w->data);
+}
+
+void
+image_png_write_finish(image *im, image_writer *w, int complete)
+{
+  if (w->png_ptr == NULL)
+    return;
+
+  if (complete && !w->failed) {
+    if (!setjmp( png_jmpbuf(w->png_ptr) ))
+      png_write_end(w->png_ptr, w->info_ptr);
+  }
+
+  png_destroy_write_struct(&w->png_ptr, &w->info_ptr);
+  Safefree(w->data);
+}
+
 void
 image_png_finish(image *im)
 {
@@ -0,0 +1,191 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Worker pool used by the threads resize option.  The workers are created the
+// first time they are needed and then kept around for later resizes.  The
+// calling thread always runs part 0 of a job itself, idle workers claim the
+// other parts.  Every row is produced by exactly one part with the same code as
+// a single-threaded resize, so the output does not depend on the number of threads.
+
+// Number of parts a job of len rows will be split into
+int
+image_pool_parts(image *im, int len)
+{
+  int parts = im->threads;
+
+#ifndef HAVE_PTHREAD
+  parts = 1;
+#endif
+
+  if (parts > IMAGE_POOL_MAX_THREADS)
+    parts = IMAGE_POOL_MAX_THREADS;
+  if (parts > len)
+    parts = len;
+  if (parts < 1)
+    parts = 1;
+
+  return parts;
+}
+
+static inline void
+image_pool_run_part(image *im, int len, int parts, int part, image_pool_job job, void *arg)
+{
+  int start = (int)((int64_t)len * part / parts);
+  int end   = (int)((int64_t)len * (part + 1) / parts);
+
+  job(im, arg, part, start, end);
+}
+
+#ifdef HAVE_PTHREAD
+static struct {
+  pthread_mutex_t run_lock; // only one job runs at a time
+  pthread_mutex_t lock;     // protects the rest of the struct
+  pthread_cond_t  work;     // signalled when a job is posted
+  pthread_cond_t  done;     // signalled when the last worker part finishes
+  int             workers;
+  int             forked;   // pthread_atfork handler has been installed
+  int             next;     // next part to be claimed by a worker
+  int             pending;  // worker parts that have not finished
+
+  // The current job
+  image           *im;
+  image_pool_job  job;
+  void            *arg;
+  int             len;
+  int             parts;
+} image_pool = {
+  PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_MUTEX_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER,
+  0, 0, 0, 0,
+  NULL, NULL, NULL, 0, 0
+};
+
+static void *
+image_pool_worker(void *ARGUNUSED(data))
+{
+  pthread_mutex_lock(&image_pool.lock);
+
+  for (;;) {
+    int part;
+
+    while (image_pool.next >= image_pool.parts)
+      pthread_cond_wait(&image_pool.work, &image_pool.lock);
+
+    part = image_pool.next++;
+    pthread_mutex_unlock(&image_pool.lock);
+
+    image_pool_run_part(image_pool.im, image_pool.len, image_pool.parts, part, image_pool.job, image_pool.arg);
+
+    pthread_mutex_lock(&image_pool.lock);
+    if (--image_pool.pending == 0)
+      pthread_cond_signal(&image_pool.done);
+  }
+
+  return NULL;
+}
+
+// Threads don't survive a fork, a child process starts over with an empty pool
+static void
+image_pool_atfork_child(void)
+{
+  pthread_mutex_init(&image_pool.run_lock, NULL);
+  pthread_mutex_init(&image_pool.lock, NULL);
+  pthread_cond_init(&image_pool.work, NULL);
+  pthread_cond_init(&image_pool.done, NULL);
+  image_pool.workers = 0;
+  image_pool.next    = 0;
+  image_pool.parts   = 0;
+  image_pool.pending = 0;
+}
+
+// Start workers until there are enough for parts, returns the number of parts
+// that can actually be run.  Called with image_pool.lock held.
+static int
+image_pool_grow(int parts)
+{
+  pthread_attr_t attr;
+  sigset_t all, old;
+
+  if (!image_pool.forked) {
+    pthread_atfork(NULL, NULL, image_pool_atfork_child);
+    image_pool.forked = 1;
+  }
+
+  // Signals are left to the Perl thread
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (image_pool.workers < parts - 1) {
+    pthread_t tid;
+
+    if ( pthread_create(&tid, &attr, image_pool_worker, NULL) != 0 )
+      break;
+
+    image_pool.workers++;
+  }
+
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  DEBUG_TRACE("Thread pool has %d workers\n", image_pool.workers);
+
+  return MIN(parts, image_pool.workers + 1);
+}
+#endif
+
+void
+image_pool_run(image *im, int len, image_pool_job job, void *arg)
+{
+  int parts = image_pool_parts(im, len);
+
+#ifdef HAVE_PTHREAD
+  if (parts > 1) {
+    pthread_mutex_lock(&image_pool.run_lock);
+    pthread_mutex_lock(&image_pool.lock);
+
+    if (image_pool.workers < parts - 1)
+      parts = image_pool_grow(parts);
+
+    image_pool.im      = im;
+    image_pool.job     = job;
+    image_pool.arg     = arg;
+    image_pool.len     = len;
+    image_pool.parts   = parts;
+    image_pool.next    = 1;
+    image_pool.pending = parts - 1;
+
+    pthread_cond_broadcast(&image_pool.work);
+    pthread_mutex_unlock(&image_pool.lock);
+
+    image_pool_run_part(im, len, parts, 0, job, arg);
+
+    pthread_mutex_lock(&image_pool.lock);
+    while (image_pool.pending > 0)
+      pthread_cond_wait(&image_pool.done, &image_pool.lock);
+    pthread_mutex_unlock(&image_pool.lock);
+
+    pthread_mutex_unlock(&image_pool.run_lock);
+    return;
+  }
+#endif
+
+  image_pool_run_part(im, len, 1, 0, job, arg);
+}
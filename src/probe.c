@@ -0,0 +1,322 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Reads the size of an image from its header without creating a decoder,
+// for Image::Scale->probe and probe_many
+
+#define PROBE_BE16(p) (((p)[0] << 8) | (p)[1])
+#define PROBE_LE16(p) ((p)[0] | ((p)[1] << 8))
+#define PROBE_BE32(p) (((uint32_t)(p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+#define PROBE_LE32(p) ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+// Returns len bytes at pos, only reading from the file if they are not already
+// in the buffer.  Returns NULL if there is not enough data
+static unsigned char *
+image_probe_read(image_probe_src *ps, int pos, int len)
+{
+  int n;
+
+  if (pos < 0 || len > PROBE_BUFFER_SIZE)
+    return NULL;
+
+  if (ps->length >= 0 && pos + len > ps->length)
+    return NULL;
+
+  if (ps->fd < 0)
+    return ps->data + ps->offset + pos;
+
+  if (pos < ps->buf_pos || pos + len > ps->buf_pos + ps->buf_len) {
+    DEBUG_TRACE("Probe reading from file @ %d\n", ps->offset + pos);
+
+    if (PerlLIO_lseek(ps->fd, ps->offset + pos, SEEK_SET) < 0)
+      return NULL;
+
+    n = PerlLIO_read(ps->fd, ps->buf, PROBE_BUFFER_SIZE);
+
+    ps->buf_pos = pos;
+    ps->buf_len = n > 0 ? n : 0;
+
+    if (len > ps->buf_len)
+      return NULL;
+  }
+
+  return ps->buf + (pos - ps->buf_pos);
+}
+
+// Orientation from IFD0 of an APP1 Exif marker, len is how much of the marker
+// could be read.  See image_jpeg_parse_exif() for the full version
+static void
+image_probe_exif(image_probe_info *info, unsigned char *p, int len)
+{
+  unsigned char *tiff = p + 6;
+  int le, ifd, count, i;
+
+  if (len < 14 || memcmp(p, "Exif\0\0", 6))
+    return;
+
+  len -= 6;
+
+  if (tiff[0] == 'I' && tiff[1] == 'I')
+    le = 1;
+  else if (tiff[0] == 'M' && tiff[1] == 'M')
+    le = 0;
+  else
+    return;
+
+  ifd = le ? PROBE_LE32(tiff + 4) : PROBE_BE32(tiff + 4);
+  if (ifd < 8 || ifd + 2 > len)
+    return;
+
+  count = le ? PROBE_LE16(tiff + ifd) : PROBE_BE16(tiff + ifd);
+
+  for (i = 0; i < count; i++) {
+    unsigned char *entry = tiff + ifd + 2 + i * 12;
+    int tag;
+
+    if (ifd + 2 + (i + 1) * 12 > len)
+      break;
+
+    tag = le ? PROBE_LE16(entry) : PROBE_BE16(entry);
+    if (tag == 0x112) {
+      info->orientation = le ? PROBE_LE16(entry + 8) : PROBE_BE16(entry + 8);
+      DEBUG_TRACE("Probe Exif Orientation: %d\n", info->orientation);
+      break;
+    }
+  }
+}
+
+// Walks the markers up to the first SOFn, reading APP1 for the orientation on the way
+static int
+image_probe_jpeg(image_probe_src *ps, image_probe_info *info)
+{
+  unsigned char *p;
+  int pos = 2;
+
+  while ( (p = image_probe_read(ps, pos, 4)) != NULL ) {
+    int marker = p[1];
+    int seglen;
+
+    if (p[0] != 0xFF) { // extraneous bytes, skipped the same as libjpeg does
+      pos++;
+      continue;
+    }
+
+    if (marker == 0xFF) { // fill byte
+      pos++;
+      continue;
+    }
+
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { // no length
+      pos += 2;
+      continue;
+    }
+
+    if (marker == 0xD9 || marker == 0xDA) // EOI or SOS before any SOFn
+      return 0;
+
+    seglen = PROBE_BE16(p + 2);
+    if (seglen < 2)
+      return 0;
+
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      if ( (p = image_probe_read(ps, pos + 4, 6)) == NULL )
+        return 0;
+
+      info->height   = PROBE_BE16(p + 1);
+      info->width    = PROBE_BE16(p + 3);
+      info->channels = p[5];
+
+      return 1;
+    }
+
+    if (marker == 0xE1 && info->orientation == ORIENTATION_NORMAL) {
+      int len = MIN(seglen - 2, PROBE_BUFFER_SIZE);
+
+      // Only the start of a large marker is needed for IFD0
+      while (len > 0 && (p = image_probe_read(ps, pos + 4, len)) == NULL)
+        len /= 2;
+
+      if (len > 0)
+        image_probe_exif(info, p, len);
+    }
+
+    pos += 2 + seglen;
+  }
+
+  return 0;
+}
+
+static int
+image_probe_png(image_probe_src *ps, image_probe_info *info)
+{
+  unsigned char *p = image_probe_read(ps, 0, 26);
+
+  if (p == NULL || memcmp(p + 12, "IHDR", 4))
+    return 0;
+
+  info->width  = PROBE_BE32(p + 16);
+  info->height = PROBE_BE32(p + 20);
+
+  switch (p[25]) {
+    case 0: // gray
+      info->channels = 1;
+      break;
+    case 4: // gray + alpha
+      info->channels = 2;
+      break;
+    case 2: // RGB
+    case 3: // palette
+      info->channels = 3;
+      break;
+    case 6: // RGBA
+      info->channels = 4;
+      break;
+    default:
+      return 0;
+  }
+
+  return 1;
+}
+
+static int
+image_probe_gif(image_probe_src *ps, image_probe_info *info)
+{
+  unsigned char *p = image_probe_read(ps, 0, 10);
+
+  if (p == NULL)
+    return 0;
+
+  // Logical screen size, the same as image_gif_read_header()
+  info->width    = PROBE_LE16(p + 6);
+  info->height   = PROBE_LE16(p + 8);
+  info->channels = 3;
+
+  return 1;
+}
+
+static int
+image_probe_bmp(image_probe_src *ps, image_probe_info *info)
+{
+  unsigned char *p = image_probe_read(ps, 0, 26);
+
+  if (p == NULL)
+    return 0;
+
+  if (PROBE_LE32(p + 14) == 12) { // OS/2 BITMAPCOREHEADER
+    info->width  = PROBE_LE16(p + 18);
+    info->height = PROBE_LE16(p + 20);
+  }
+  else {
+    info->width  = (int32_t)PROBE_LE32(p + 18);
+    info->height = abs((int32_t)PROBE_LE32(p + 22)); // negative if flipped
+  }
+
+  // Alpha in 32-bit BMPs is not used, see image_bmp_load()
+  info->channels = 3;
+
+  return 1;
+}
+
+// Returns a hashref of type, width, height, channels and orientation, or undef
+// if src, a path or scalar ref, is not an image that can be probed
+SV *
+image_probe(SV *src, HV *opts, image_probe_src *ps)
+{
+  image_probe_info info;
+  unsigned char *p;
+  HV *hv;
+  int ok = 0;
+
+  Zero(&info, 1, image_probe_info);
+  info.orientation = ORIENTATION_NORMAL;
+
+  ps->fd      = -1;
+  ps->data    = NULL;
+  ps->offset  = 0;
+  ps->length  = -1;
+  ps->buf_pos = 0;
+  ps->buf_len = 0;
+
+  if (opts != NULL) {
+    if (my_hv_exists(opts, "offset"))
+      ps->offset = SvIV(*(my_hv_fetch(opts, "offset")));
+
+    if (my_hv_exists(opts, "length"))
+      ps->length = SvIV(*(my_hv_fetch(opts, "length")));
+  }
+
+  if (ps->offset < 0)
+    return newSV(0);
+
+  if ( SvROK(src) && !sv_isobject(src) && SvTYPE(SvRV(src)) < SVt_PVAV ) {
+    // Scalar ref
+    STRLEN len;
+
+    ps->data = (unsigned char *)SvPV(SvRV(src), len);
+
+    if (ps->offset > len)
+      return newSV(0);
+
+    if (ps->length < 0 || ps->length > len - ps->offset)
+      ps->length = len - ps->offset;
+  }
+  else {
+    // Path, or an object such as Path::Tiny that stringifies to one
+    ps->fd = PerlLIO_open(SvPV_nolen(src), O_RDONLY | O_BINARY);
+    if (ps->fd < 0)
+      return newSV(0);
+  }
+
+  // Same magic bytes as image_init()
+  if ( (p = image_probe_read(ps, 0, 8)) != NULL ) {
+    if (p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) {
+      info.type = JPEG;
+      ok = image_probe_jpeg(ps, &info);
+    }
+    else if (!memcmp(p, "\x89PNG\r\n\x1a\n", 8)) {
+      info.type = PNG;
+      ok = image_probe_png(ps, &info);
+    }
+    else if (!memcmp(p, "GIF8", 4) && (p[4] == '7' || p[4] == '9') && p[5] == 'a') {
+      info.type = GIF;
+      ok = image_probe_gif(ps, &info);
+    }
+    else if (p[0] == 'B' && p[1] == 'M') {
+      info.type = BMP;
+      ok = image_probe_bmp(ps, &info);
+    }
+  }
+
+  if (ps->fd >= 0)
+    PerlLIO_close(ps->fd);
+
+  if (!ok || info.width <= 0 || info.height <= 0)
+    return newSV(0);
+
+  DEBUG_TRACE("Probed type %d, %d x %d, channels %d, orientation %d\n",
+    info.type, info.width, info.height, info.channels, info.orientation);
+
+  hv = newHV();
+  my_hv_store( hv, "type", newSVpv(
+    info.type == JPEG ? "jpeg" : info.type == PNG ? "png" : info.type == GIF ? "gif" : "bmp", 0
+  ) );
+  my_hv_store( hv, "width", newSViv(info.width) );
+  my_hv_store( hv, "height", newSViv(info.height) );
+  my_hv_store( hv, "channels", newSViv(info.channels) );
+  my_hv_store( hv, "orientation", newSViv(info.orientation) );
+
+  return newRV_noinc((SV *)hv);
+}
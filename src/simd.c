@@ -0,0 +1,152 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Runtime selection of the resize kernels.  The SIMD kernels are compiled with
+// per-function target attributes, so the module itself is still built for the
+// baseline CPU and the best set this CPU supports is picked on first use.
+// The IMAGE_SCALE_SIMD environment variable (generic, sse41, or avx2) or
+// Image::Scale->simd can be used to force a particular set.
+
+static const image_kernels image_kernels_generic = {
+  "generic",
+  image_downsize_gd_fixed_point_rows_generic,
+  image_downsize_gm_horizontal_filter_generic,
+  image_downsize_gm_vertical_filter_generic,
+  image_downsize_gm_horizontal_filter_fixed_point_generic,
+  image_downsize_gm_vertical_filter_fixed_point_generic
+};
+
+#ifdef HAVE_SIMD
+static const image_kernels image_kernels_sse41 = {
+  "sse41",
+  image_downsize_gd_fixed_point_rows_sse41,
+  image_downsize_gm_horizontal_filter_sse41,
+  image_downsize_gm_vertical_filter_sse41,
+  image_downsize_gm_horizontal_filter_fixed_point_sse41,
+  image_downsize_gm_vertical_filter_fixed_point_sse41
+};
+
+static const image_kernels image_kernels_avx2 = {
+  "avx2",
+  image_downsize_gd_fixed_point_rows_avx2,
+  image_downsize_gm_horizontal_filter_avx2,
+  image_downsize_gm_vertical_filter_avx2,
+  image_downsize_gm_horizontal_filter_fixed_point_avx2,
+  image_downsize_gm_vertical_filter_fixed_point_avx2
+};
+#endif
+
+static const image_kernels *
+image_simd_kernels(int level)
+{
+  switch (level) {
+#ifdef HAVE_SIMD
+    case IMAGE_SIMD_AVX2:
+      return &image_kernels_avx2;
+    case IMAGE_SIMD_SSE41:
+      return &image_kernels_sse41;
+#endif
+    default:
+      return &image_kernels_generic;
+  }
+}
+
+int
+image_simd_supported(int level)
+{
+  switch (level) {
+    case IMAGE_SIMD_GENERIC:
+      return 1;
+#ifdef HAVE_SIMD
+    case IMAGE_SIMD_SSE41:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse4.1");
+    case IMAGE_SIMD_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    default:
+      return 0;
+  }
+}
+
+static int
+image_simd_level(const char *name)
+{
+  if ( !strcmp(name, "generic") )
+    return IMAGE_SIMD_GENERIC;
+  if ( !strcmp(name, "sse41") )
+    return IMAGE_SIMD_SSE41;
+  if ( !strcmp(name, "avx2") )
+    return IMAGE_SIMD_AVX2;
+
+  return -1;
+}
+
+// Returns the best supported level at or below the requested one
+static int
+image_simd_best(int level)
+{
+  while (level > IMAGE_SIMD_GENERIC && !image_simd_supported(level))
+    level--;
+
+  return level;
+}
+
+void
+image_simd_init(void)
+{
+  const char *name = getenv("IMAGE_SCALE_SIMD");
+
+  simd = image_simd_kernels( image_simd_best(IMAGE_SIMD_AVX2) );
+
+  if (name != NULL && *name) {
+    if ( !image_simd_set(name) )
+      warn("Image::Scale unknown IMAGE_SCALE_SIMD value %s, using %s\n", name, simd->name);
+  }
+
+  DEBUG_TRACE("Using %s resize kernels\n", simd->name);
+}
+
+const char *
+image_simd_name(void)
+{
+  if (simd == NULL)
+    image_simd_init();
+
+  return simd->name;
+}
+
+// Select a kernel set by name, returns 0 if the name is unknown.  If the CPU
+// does not support the requested set the best supported one is used instead.
+int
+image_simd_set(const char *name)
+{
+  int level = image_simd_level(name);
+  int best;
+
+  if (level < 0)
+    return 0;
+
+  best = image_simd_best(level);
+  if (best != level)
+    warn("Image::Scale %s resize kernels are not supported by this CPU, using %s\n",
+      name, image_simd_kernels(best)->name);
+
+  simd = image_simd_kernels(best);
+
+  return 1;
+}
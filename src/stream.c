@@ -0,0 +1,225 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Streaming resize.  The gd resizers produce each destination row from a
+// contiguous range of source rows, so they can run while the image is being
+// decoded: pixbuf becomes a ring of the last ring_rows source rows, and
+// destination rows are produced as soon as the rows they cover have been
+// decoded.  Peak memory for the source is then a few rows instead of the whole
+// image.  Only loaders that produce rows top to bottom call image_alloc_rows(),
+// the others (and the GM resizers) still decode the whole image first.
+typedef struct image_stream {
+  image_pool_job job;   // resize kernel for a range of destination rows
+  void *arg;            // the tables for job
+  gd_span *yspans;      // source rows covered by each destination row
+  int dstY, dstH;
+  int done;             // destination rows already produced
+  int first;            // first destination row of the batch being run
+  gd_tables t;
+  gd_fixed_tables t_fixed;
+} image_stream;
+
+static void
+image_stream_job(image *im, void *arg, int part, int start, int end)
+{
+  image_stream *s = (image_stream *)arg;
+
+  s->job(im, s->arg, part, s->first + start, s->first + end);
+}
+
+// Produce every destination row not yet done whose source rows are all below loaded
+static void
+image_stream_run(image *im, int loaded)
+{
+  image_stream *s = im->stream;
+  int end = s->done;
+
+  while (end < s->dstH && s->yspans[end].start + s->yspans[end].count <= loaded)
+    end++;
+
+  while (s->done < end) {
+    int rows = end - s->done;
+
+    // Rows are encoded as soon as they are done when saving, outbuf only holds outbuf_rows of them
+    if (im->outbuf_rows && rows > im->outbuf_rows)
+      rows = im->outbuf_rows;
+
+    DEBUG_TRACE("Streaming destination rows %d - %d\n", s->done, s->done + rows);
+
+    s->first = s->done;
+    image_pool_run(im, rows, image_stream_job, s);
+    s->done += rows;
+
+    if (im->outbuf_rows)
+      image_writer_rows(im, s->dstY + s->first, s->dstY + s->done);
+  }
+}
+
+// Allocate pixbuf for a source of width x height, called by the loaders once the
+// size of the decoded image is known.  Rows must then be written to image_load_row().
+void
+image_alloc_rows(image *im, int width, int height)
+{
+  image_stream *s;
+  int i, rows = 0;
+
+  if ( !im->can_stream || (width == im->target_width && height == im->target_height) ) {
+    image_alloc(im, width, height);
+    return;
+  }
+
+  Newz(0, s, 1, image_stream);
+  im->stream = s;
+
+  // When saving an image that isn't flipped vertically or rotated, rows are produced
+  // in output order and can be encoded right away.  Not for PNG output of an image
+  // that may be transparent, whether to write alpha isn't known until it is decoded
+  if (im->writer != NULL && (im->orientation == ORIENTATION_NORMAL || im->orientation == ORIENTATION_MIRROR_HORIZ)
+    && !(im->save_type == PNG && im->has_alpha))
+    im->outbuf_rows = MIN(im->target_height, MAX(IMAGE_STREAM_ROWS, image_pool_parts(im, im->target_height)));
+
+  if ( !image_outbuf_alloc(im) ) {
+    int wanted = im->memory_used + im->target_width * (im->outbuf_rows ? im->outbuf_rows : im->target_height) * sizeof(pix);
+    image_finish(im);
+    croak("Image::Scale memory_limit exceeded (wanted to allocate %d bytes)\n", wanted);
+  }
+
+  if (im->resize_type == IMAGE_SCALE_TYPE_GD_FIXED) {
+    image_gd_fixed_tables_init(im, &s->t_fixed);
+
+    // Rows that were already resized are gone by the time an overflow could be seen, so
+    // unlike image_downsize_gd_fixed_point() there is no falling back afterwards.  Every
+    // sum is at most 255 times the largest xspan weight times the largest yspan weight,
+    // so once this check passes the overflow flags can't be set.
+    if ( image_gd_fixed_may_overflow(&s->t_fixed) ) {
+      DEBUG_TRACE("Fixed-point sums may overflow, streaming with floating-point\n");
+      image_gd_fixed_tables_free(im, &s->t_fixed);
+    }
+    else {
+      s->job    = simd->gd_fixed_point_rows;
+      s->arg    = &s->t_fixed;
+      s->yspans = s->t_fixed.yspans;
+      s->dstY   = s->t_fixed.dstY;
+      s->dstH   = s->t_fixed.dstH;
+    }
+  }
+
+  if (s->job == NULL) {
+    image_gd_tables_init(im, &s->t);
+    s->job    = image_downsize_gd_rows;
+    s->arg    = &s->t;
+    s->yspans = s->t.yspans;
+    s->dstY   = s->t.dstY;
+    s->dstH   = s->t.dstH;
+  }
+
+  for (i = 0; i < s->dstH; i++)
+    rows = MAX(rows, s->yspans[i].count);
+
+  // Enough rows for at least one destination row per thread in each batch
+  im->ring_rows = rows + MAX(IMAGE_STREAM_ROWS, rows * image_pool_parts(im, s->dstH));
+  if (im->ring_rows > height)
+    im->ring_rows = height;
+
+  DEBUG_TRACE("Streaming %d x %d source through %d rows\n", width, height, im->ring_rows);
+
+  image_alloc(im, width, im->ring_rows);
+}
+
+// Returns where to store source row y.  While streaming, this first produces the
+// destination rows that still need the row it replaces.
+pix *
+image_load_row(image *im, int y)
+{
+  pix *row;
+
+  image_load_rows(im, y, 1, &row);
+
+  return row;
+}
+
+// Like image_load_row() for loaders that decode several rows at once, stores where
+// to put source rows y to y + count - 1 in rows (they may wrap around the ring).
+// Returns how many rows can be stored before the next call, at least 1
+int
+image_load_rows(image *im, int y, int count, pix **rows)
+{
+  image_stream *s = im->stream;
+  int last, i;
+
+  if (y + count > im->height)
+    count = im->height - y;
+
+  last = y + count - 1;
+
+  if (s != NULL && last >= im->ring_rows && s->done < s->dstH
+    && s->yspans[s->done].start <= last - im->ring_rows) {
+    image_stream_run(im, y);
+
+    // Rows that are still needed can't be replaced yet
+    if (s->done < s->dstH && s->yspans[s->done].start + im->ring_rows - y < count)
+      count = s->yspans[s->done].start + im->ring_rows - y;
+  }
+
+  for (i = 0; i < count; i++)
+    rows[i] = image_row(im, y + i);
+
+  return count;
+}
+
+// Called after the loader has finished, produces the remaining destination rows
+void
+image_stream_finish(image *im)
+{
+  image_stream *s = im->stream;
+  int i;
+
+  image_stream_run(im, INT32_MAX);
+
+  // Ruled out by image_gd_fixed_may_overflow() in image_alloc_rows()
+  if (s->arg == &s->t_fixed) {
+    for (i = 0; i < image_pool_parts(im, s->dstH); i++) {
+      gd_fixed_part *part = &s->t_fixed.parts[i];
+
+      if (part->overflow) {
+        warn("fixed-point overflow while streaming: %d %d %d %d\n",
+          part->values[0], part->values[1], part->values[2], part->values[3]);
+        break;
+      }
+    }
+  }
+
+  image_stream_free(im);
+  image_outbuf_rotated(im);
+}
+
+void
+image_stream_free(image *im)
+{
+  image_stream *s = im->stream;
+
+  if (s == NULL)
+    return;
+
+  if (s->arg == &s->t)
+    image_gd_tables_free(&s->t);
+  else if (s->arg == &s->t_fixed)
+    image_gd_fixed_tables_free(im, &s->t_fixed);
+
+  Safefree(s);
+  im->stream = NULL;
+  im->ring_rows = 0;
+}
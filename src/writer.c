@@ -0,0 +1,202 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// The save_jpeg and save_png resize options encode the resized image as part of
+// the resize.  When the resize is streamed (see stream.c) and rows come out in
+// order, each batch of rows is encoded as soon as it has been produced and
+// outbuf only holds one batch.  Otherwise the whole resized image is encoded
+// once the resize is done.
+
+// Create and open a file named by replacing the trailing XXXXXX of tmp_path, without
+// ever opening a file or symlink that is already there.  Returns the fd or -1
+static int
+image_writer_mkstemp(char *tmp_path)
+{
+  int fd;
+#ifdef HAS_MKSTEMP
+  Mode_t mask;
+
+  if ((fd = mkstemp(tmp_path)) < 0)
+    return -1;
+
+# ifdef HAS_FCHMOD
+  // mkstemp creates the file 0600, give it the permissions fopen would have
+  mask = PerlLIO_umask(0);
+  PerlLIO_umask(mask);
+  fchmod(fd, 0666 & ~mask);
+# endif
+#else
+  char *suffix = tmp_path + strlen(tmp_path) - 6;
+  int i;
+
+  for (i = 0; i < 100; i++) {
+    sprintf(suffix, "%06d", (int)((PerlProc_getpid() * 100 + i) % 1000000));
+    fd = PerlLIO_open3(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+    if (fd >= 0 || errno != EEXIST)
+      break;
+  }
+#endif
+
+  return fd;
+}
+
+// Called before decoding, so a bad path is reported before doing any work.  Files are
+// written to a new file next to the destination and only replace it once complete, so
+// a resize that fails doesn't leave an existing file truncated
+void
+image_writer_open(image *im)
+{
+  image_writer *w;
+
+  // Left over from a resize that croaked
+  image_writer_free(im);
+
+  Newz(0, w, 1, image_writer);
+  w->quality = im->save_quality;
+  w->png_options = im->save_png_options;
+
+  if (SvROK(im->save_dest) && !sv_isobject(im->save_dest)) {
+    w->sv_buf = SvRV(im->save_dest);
+    sv_setpvn(w->sv_buf, "", 0);
+  }
+  else {
+    char *path = SvPV_nolen(im->save_dest);
+    int fd;
+
+    New(0, w->tmp_path, strlen(path) + 8, char);
+    sprintf(w->tmp_path, "%s.XXXXXX", path);
+
+    if ((fd = image_writer_mkstemp(w->tmp_path)) < 0 || (w->out = fdopen(fd, "wb")) == NULL) {
+      if (fd >= 0) {
+        PerlLIO_close(fd);
+        PerlLIO_unlink(w->tmp_path);
+      }
+      Safefree(w->tmp_path);
+      Safefree(w);
+      croak("Image::Scale cannot open %s for writing\n", path);
+    }
+
+    w->path = savepv(path);
+  }
+
+  im->writer = w;
+}
+
+static void
+image_writer_row(image *im, image_writer *w, pix *row)
+{
+  switch (im->save_type) {
+#ifdef HAVE_JPEG
+    case JPEG:
+      image_jpeg_write_row(im, w, row);
+      break;
+#endif
+#ifdef HAVE_PNG
+    case PNG:
+      image_png_write_row(im, w, row);
+      break;
+#endif
+  }
+
+  w->rows++;
+}
+
+// Encode output rows up to end.  While streaming, rows before start are
+// keep_aspect padding that was never stored in outbuf.
+void
+image_writer_rows(image *im, int start, int end)
+{
+  image_writer *w = im->writer;
+
+  if (w->rows < start) {
+    if (w->bgrow == NULL) {
+      New(0, w->bgrow, im->target_width, pix);
+      image_bgcolor_fill(w->bgrow, im->target_width, im->bgcolor);
+    }
+
+    while (w->rows < start)
+      image_writer_row(im, w, w->bgrow);
+  }
+
+  while (w->rows < end)
+    image_writer_row(im, w, image_out_row(im, w->rows));
+}
+
+static void
+image_writer_end(image *im, int complete)
+{
+  image_writer *w = im->writer;
+  char *rename_failed = NULL;
+
+  if (w == NULL)
+    return;
+
+  switch (im->save_type) {
+#ifdef HAVE_JPEG
+    case JPEG:
+      image_jpeg_write_finish(im, w, complete);
+      break;
+#endif
+#ifdef HAVE_PNG
+    case PNG:
+      image_png_write_finish(im, w, complete);
+      break;
+#endif
+  }
+
+  if (w->out != NULL) {
+    if (fclose(w->out) == 0 && complete && !w->failed) {
+      if (PerlLIO_rename(w->tmp_path, w->path) != 0) {
+        PerlLIO_unlink(w->tmp_path);
+        rename_failed = w->path;
+        SAVEFREEPV(rename_failed);
+        w->path = NULL;
+      }
+    }
+    else {
+      PerlLIO_unlink(w->tmp_path);
+    }
+
+    Safefree(w->path);
+    Safefree(w->tmp_path);
+  }
+
+  Safefree(w->bgrow);
+  Safefree(w);
+  im->writer = NULL;
+
+  if (rename_failed != NULL)
+    croak("Image::Scale cannot write %s\n", rename_failed);
+}
+
+// Encode whatever is left of the resized image and finish the output
+void
+image_writer_close(image *im)
+{
+  if (im->outbuf_rows)
+    image_writer_rows(im, im->target_height, im->target_height);
+  else
+    image_writer_rows(im, 0, im->target_height);
+
+  image_writer_end(im, 1);
+}
+
+// Abandon the output after an error
+void
+image_writer_free(image *im)
+{
+  image_writer_end(im, 0);
+}
@@ -3,7 +3,7 @@ use strict;
 use File::Path ();
 use File::Spec::Functions;
 use FindBin ();
-use Test::More tests => 30;
+use Test::More tests => 36;
 require Test::NoWarnings;
 
 use Image::Scale;
@@ -128,6 +128,50 @@ SKIP:
     is( _compare( _load($outfile), "apic_gd_fixed_point_w127.png" ), 1, "BMP resize_gd_fixed_point from offset ID3 tag ok" );
 }
 
+# offset image in MP3 ID3v2 tag in a scalar
+SKIP:
+{
+    my $im = Image::Scale->new(
+        _load( _f('v2.4-apic-bmp-318-24632.mp3') ),
+        { offset => 318, length => 24632 }
+    );
+
+    is( $im->width, 127, 'BMP from offset ID3 tag in scalar width ok' );
+
+    $im->resize_gd_fixed_point( { width => 127 } );
+
+    skip "PNG support not built, skipping file comparison tests", 1 if !$png_version;
+
+    is( _compare( \$im->as_png(), "apic_gd_fixed_point_w127.png" ), 1, "BMP resize_gd_fixed_point from offset ID3 tag in scalar ok" );
+}
+
+# offset image in MP3 ID3v2 tag, memory-mapped
+SKIP:
+{
+    my $im = Image::Scale->new(
+        _f('v2.4-apic-bmp-318-24632.mp3'),
+        { offset => 318, length => 24632, mmap => 1 }
+    );
+
+    is( $im->width, 127, 'BMP from offset ID3 tag with mmap width ok' );
+
+    $im->resize_gd_fixed_point( { width => 127 } );
+
+    skip "PNG support not built, skipping file comparison tests", 1 if !$png_version;
+
+    is( _compare( \$im->as_png(), "apic_gd_fixed_point_w127.png" ), 1, "BMP resize_gd_fixed_point from offset ID3 tag with mmap ok" );
+}
+
+# Too short to have a header
+{
+    my $data = 'BM';
+    eval { Image::Scale->new( \$data ) };
+    like( $@, qr/Unable to read image header for \(data\)/, 'short scalar dies ok' );
+
+    eval { Image::Scale->new( _load( _f('24bit.bmp') ), { offset => 24630 } ) };
+    like( $@, qr/Unable to read image header/, 'offset past the end of a scalar dies ok' );
+}
+
 END {
     File::Path::rmtree($tmpdir);
 }
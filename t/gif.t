@@ -12,7 +12,7 @@ my $gif_version = Image::Scale->gif_version();
 my $png_version = Image::Scale->png_version();
 
 if ($gif_version) {
-    plan tests => 18;
+    plan tests => 20;
 }
 else {
     plan skip_all => 'Image::Scale not built with giflib support';
@@ -150,6 +150,23 @@ SKIP:
     is( _compare( _load($outfile), "apic_gd_fixed_point_w100.png" ), 1, "GIF resize_gd_fixed_point from offset ID3 tag ok" );
 }
 
+# offset image in MP3 ID3v2 tag, memory-mapped
+SKIP:
+{
+    my $im = Image::Scale->new(
+        _f('v2.4-apic-gif-318-5169.mp3'),
+        { offset => 318, length => 5169, mmap => 1 }
+    );
+
+    is( $im->width, 160, 'GIF from offset ID3 tag with mmap width ok' );
+
+    $im->resize_gd_fixed_point( { width => 100 } );
+
+    skip "PNG support not built, skipping file comparison tests", 1 if !$png_version;
+
+    is( _compare( \$im->as_png(), "apic_gd_fixed_point_w100.png" ), 1, "GIF resize_gd_fixed_point from offset ID3 tag with mmap ok" );
+}
+
 # Bug 17573, very thin gif could cause divide by 0 errors
 SKIP:
 {
@@ -11,7 +11,7 @@ use Image::Scale;
 my $jpeg_version = Image::Scale->jpeg_version();
 
 if ($jpeg_version) {
-    plan tests => 117;
+    plan tests => 140;
 }
 else {
     plan skip_all => 'Image::Scale not built with libjpeg support';
@@ -142,6 +142,46 @@ SKIP:
     like( $@, qr/memory_limit exceeded/, 'JPEG memory_limit ok' );
 }
 
+# Ratios that are not a power of 2 are decoded with a M/8 DCT scale (5/8 here)
+{
+    my $im = Image::Scale->new( _f("rgb.jpg") );
+    ok( eval { $im->resize_gm( { width => 180, memory_limit => 300_000 } ); 1 }, 'JPEG M/8 scaled decode memory_limit ok' );
+    is( $im->resized_width(), 180, 'JPEG M/8 scaled decode width ok' );
+}
+
+# snap to a DCT scaled size (1/4 is 79 x 59)
+{
+    my $im = Image::Scale->new( _f("rgb.jpg") );
+    $im->resize_gd_fixed_point( { width => 78, snap => 2 } );
+    is( $im->resized_width() . 'x' . $im->resized_height(), '79x59', 'JPEG snap ok' );
+
+    my $im2 = Image::Scale->new( _f("rgb.jpg") );
+    $im2->resize_gd_fixed_point( { width => 79, height => 59 } );
+    ok( $im->as_png() eq $im2->as_png(), 'JPEG snap matches plain decode ok' );
+
+    $im->resize_gm( { width => 76, snap => 2 } );
+    is( $im->resized_width(), 76, 'JPEG snap outside tolerance ok' );
+
+    $im->resize_gm( { width => 78, height => 78, keep_aspect => 1, snap => 2 } );
+    is( $im->resized_width() . 'x' . $im->resized_height(), '78x78', 'JPEG snap ignored with keep_aspect ok' );
+}
+
+# 1/8 scale progressive decode stops once the DC coefficients are complete
+{
+    my $im = Image::Scale->new( _f("rgb_progressive.jpg") );
+    $im->resize_gd_fixed_point( { width => 30 } );
+    is( $im->resized_width() . 'x' . $im->resized_height(), '30x22', 'JPEG progressive 1/8 decode ok' );
+
+    # The rest of the file was not read, the object can still be reused
+    $im->resize_gd_fixed_point( { width => 100 } );
+    is( $im->resized_width(), 100, 'JPEG progressive 1/8 decode then full decode ok' );
+
+    my $im2 = Image::Scale->new( _load( _f("rgb_progressive.jpg") ) );
+    $im2->resize_gd_fixed_point( { width => 30 } );
+    $im->resize_gd_fixed_point( { width => 30 } );
+    ok( $im2->as_png() eq $im->as_png(), 'JPEG progressive 1/8 decode from scalar ok' );
+}
+
 # corrupt truncated file but will still resize with a gray area
 SKIP:
 {
@@ -380,6 +420,25 @@ SKIP:
     is( _compare( _load($outfile), "apic_gd_fixed_point_w50.jpg" ), 1, "JPEG resize_gd_fixed_point from offset ID3 tag ok" );
 }
 
+# offset image in MP3 ID3v2 tag in a scalar, decoded in place from the scalar
+{
+    my $im = Image::Scale->new(
+        _f('v2.4-apic-jpg-351-2103.mp3'),
+        { offset => 351, length => 2103 }
+    );
+    $im->resize_gd_fixed_point( { width => 50 } );
+
+    my $im2 = Image::Scale->new(
+        _load( _f('v2.4-apic-jpg-351-2103.mp3') ),
+        { offset => 351, length => 2103 }
+    );
+    $im2->resize_gd_fixed_point( { width => 50 } );
+    ok( $im2->as_png() eq $im->as_png(), 'JPEG from offset ID3 tag in scalar ok' );
+
+    $im2->resize_gd_fixed_point( { width => 40 } );
+    is( $im2->resized_width(), 40, 'JPEG resize again from offset ID3 tag in scalar ok' );
+}
+
 # Exif tag larger than 4K
 {
     my $im = Image::Scale->new( _f('large-exif.jpg') );
@@ -388,7 +447,75 @@ SKIP:
 
 # XXX fatal errors during compression, will this ever actually happen?
 
-# XXX progressive JPEG with/without memory_limit
+# use_exif_thumbnail, cmyk.jpg has a 160x120 thumbnail
+{
+    my $data  = ${ _load( _f("cmyk.jpg") ) };
+    my $start = index( $data, "\xFF\xD8\xFF", 2 );
+    my $thumb = substr( $data, $start, index( $data, "\xFF\xD9", $start ) + 2 - $start );
+
+    # The height still comes from the 313x234 main image
+    my $expected = Image::Scale->new( \$thumb );
+    $expected->resize_gd_fixed_point( { width => 100, height => 74 } );
+
+    my $im = Image::Scale->new( _f("cmyk.jpg") );
+    $im->resize_gd_fixed_point( { width => 100, use_exif_thumbnail => 1 } );
+    ok( $im->as_png() eq $expected->as_png(), 'JPEG use_exif_thumbnail ok' );
+
+    # The main image is used again without the option
+    my $main = Image::Scale->new( _f("cmyk.jpg") );
+    $main->resize_gd_fixed_point( { width => 100 } );
+    $im->resize_gd_fixed_point( { width => 100 } );
+    ok( $im->as_png() eq $main->as_png(), 'JPEG resize after use_exif_thumbnail ok' );
+    ok( $im->as_png() ne $expected->as_png(), 'JPEG main image differs from thumbnail ok' );
+
+    # Larger than the thumbnail
+    $main->resize_gd_fixed_point( { width => 200 } );
+    $im->resize_gd_fixed_point( { width => 200, use_exif_thumbnail => 1 } );
+    ok( $im->as_png() eq $main->as_png(), 'JPEG use_exif_thumbnail too small ok' );
+}
+
+# Grayscale images are saved as single component JPEGs, unless a bgcolor adds color
+{
+    my %tests = (
+        'gray.jpg'         => [ {}, 1 ],
+        'rgb.jpg'          => [ {}, 3 ],
+        'gray.jpg bgcolor' => [ { height => 100, keep_aspect => 1, bgcolor => 0x336699 }, 3 ],
+        'gray.jpg gray bgcolor' => [ { height => 100, keep_aspect => 1, bgcolor => 0x808080 }, 1 ],
+    );
+
+    for my $name ( sort keys %tests ) {
+        my ( $opts, $components ) = @{ $tests{$name} };
+        my ($file) = split / /, $name;
+
+        my $im = Image::Scale->new( _f($file) );
+        $im->resize_gd_fixed_point( { width => 100, %{$opts} } );
+        is( _components( $im->as_jpeg() ), $components, "JPEG $name output components ok" );
+    }
+}
+
+# progressive JPEG with memory_limit, libjpeg's coefficient buffer counts towards the limit
+{
+    my $im = Image::Scale->new( _f("rgb_progressive.jpg") );
+    $im->resize_gm( { width => 100 } );
+
+    my $im2 = Image::Scale->new( _f("rgb_progressive.jpg") );
+    $im2->resize_gm( { width => 100, memory_limit => 1_000_000 } );
+    ok( $im2->as_png() eq $im->as_png(), 'JPEG progressive within memory_limit ok' );
+
+    my $im3 = Image::Scale->new( _f("rgb_progressive.jpg") );
+    eval { $im3->resize_gm( { width => 100, memory_limit => 200_000 } ) };
+    like( $@, qr/memory_limit exceeded/, 'JPEG progressive over memory_limit ok' );
+}
+
+# mmap option gives the same result
+for my $file ( qw(rgb.jpg rgb_progressive.jpg) ) {
+    my $im = Image::Scale->new( _f($file) );
+    $im->resize_gd_fixed_point( { width => 100 } );
+
+    my $mapped = Image::Scale->new( _f($file), { mmap => 1 } );
+    $mapped->resize_gd_fixed_point( { width => 100 } );
+    ok( $mapped->as_png() eq $im->as_png(), "JPEG $file with mmap ok" );
+}
 
 diag("libjpeg version: $jpeg_version");
 
@@ -396,6 +523,20 @@ END {
     File::Path::rmtree($tmpdir);
 }
 
+# Number of components in the SOF marker
+sub _components {
+    my $data = shift;
+    my $pos  = 2;
+
+    while ( $pos < length $data ) {
+        my ( $marker, $len ) = unpack 'x C n', substr( $data, $pos, 4 );
+        return ord( substr( $data, $pos + 9, 1 ) ) if $marker >= 0xC0 && $marker <= 0xC2;
+        $pos += 2 + $len;
+    }
+
+    return 0;
+}
+
 sub _f {
     return catfile( $FindBin::Bin, 'images', 'jpg', shift );
 }
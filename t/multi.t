@@ -0,0 +1,165 @@
+use strict;
+
+use File::Spec::Functions;
+use FindBin ();
+use Test::More;
+
+use Image::Scale;
+
+if ( Image::Scale->png_version() && Image::Scale->jpeg_version() ) {
+    plan tests => 30;
+}
+else {
+    plan skip_all => 'Image::Scale not built with libjpeg and libpng support';
+}
+
+# Sizes that are not made from an earlier result match a plain resize
+{
+    my @sizes = (
+        { width => 60 },
+        { width => 100 },
+        { width => 50, height => 50, keep_aspect => 1, method => 'resize_gm' },
+        { width => 20, method => 'resize_gd' },
+    );
+
+    my $im = Image::Scale->new( _f('png', 'rgba.png') );
+    my @out = $im->resize_multi( \@sizes );
+
+    is( scalar @out, 4, 'png resize_multi returned 4 images ok' );
+
+    for my $i ( 0 .. 2 ) {
+        my $expected = _resize( 'png', 'rgba.png', $sizes[$i] );
+        ok( $out[$i]->as_png() eq $expected->as_png(), "png resize_multi size $i matches resize ok" );
+    }
+
+    # 20 wide is made from the 60 wide result, 50x50 was padded
+    my $expected = _resize( 'png', 'rgba.png', $sizes[3] );
+    is( $out[3]->resized_width(), $expected->resized_width(), 'png resize_multi cascaded width ok' );
+    is( $out[3]->resized_height(), $expected->resized_height(), 'png resize_multi cascaded height ok' );
+}
+
+# Rotated JPEG, the largest size uses the same pre-scaled decode as resize()
+{
+    my @sizes = (
+        { width => 40 },
+        { width => 37, height => 61 },
+        { height => 150 },
+        { width => 15, ignore_exif => 1 },
+        { width => 10, height => 10, keep_aspect => 1, method => 'resize_gm_fixed_point' },
+    );
+
+    my $im = Image::Scale->new( _f('jpg', 'exif_90_ccw.jpg') );
+    my @out = $im->resize_multi( \@sizes );
+
+    for my $i ( 0 .. 4 ) {
+        my $expected = _resize( 'jpg', 'exif_90_ccw.jpg', $sizes[$i] );
+        is( $out[$i]->resized_width(), $expected->resized_width(), "jpeg resize_multi size $i width ok" );
+        is( $out[$i]->resized_height(), $expected->resized_height(), "jpeg resize_multi size $i height ok" );
+    }
+
+    my $expected = _resize( 'jpg', 'exif_90_ccw.jpg', $sizes[2] );
+    ok( $out[2]->as_jpeg() eq $expected->as_jpeg(), 'jpeg resize_multi largest size matches resize ok' );
+}
+
+# Scalar context, equal size, and the source object can still be resized
+{
+    my $im = Image::Scale->new( _f('png', 'rgb.png') );
+    my $width = $im->width;
+
+    my $out = $im->resize_multi( [ { width => $width }, { width => 10 } ] );
+
+    is( ref $out, 'ARRAY', 'resize_multi returns arrayref in scalar context ok' );
+    is( $out->[0]->resized_width(), $width, 'resize_multi equal size width ok' );
+    ok( $out->[0]->as_png() eq _resize( 'png', 'rgb.png', { width => $width } )->as_png(), 'resize_multi equal size matches resize ok' );
+    is( $out->[1]->resized_width(), 10, 'resize_multi small size width ok' );
+
+    $im->resize( { width => 30 } );
+    is( $im->resized_width(), 30, 'resize after resize_multi ok' );
+}
+
+# save_jpeg without a quality uses the same default as as_jpeg
+{
+    my $data;
+    my $im = Image::Scale->new( _f('jpg', 'rgb.jpg') );
+    $im->resize_multi( [ { width => 100, save_jpeg => \$data } ] );
+
+    ok( $data eq _resize( 'jpg', 'rgb.jpg', { width => 100 } )->as_jpeg(), 'resize_multi save_jpeg default quality ok' );
+}
+
+# A JPEG pre-scaled by an earlier resize() doesn't change the aspect ratio of the sizes
+{
+    my $sizes = [ { width => 16 }, { width => 12 } ];
+
+    my $im = Image::Scale->new( _f('jpg', 'rgb.jpg') );
+    $im->resize_gd( { width => 20 } );
+    my @out = $im->resize_multi($sizes);
+
+    is_deeply(
+        [ map { $_->resized_height() } @out ],
+        [ map { $_->resized_height() } _multi( 'jpg', 'rgb.jpg', $sizes ) ],
+        'resize_multi after resize height ok'
+    );
+    ok( $out[1]->as_jpeg() eq ( _multi( 'jpg', 'rgb.jpg', $sizes ) )[1]->as_jpeg(), 'resize_multi after resize ok' );
+}
+
+# use_exif_thumbnail from an earlier resize() doesn't carry over
+{
+    my $sizes = [ { width => 100 }, { width => 50 } ];
+
+    my $im = Image::Scale->new( _f('jpg', 'cmyk.jpg') );
+    $im->resize_gd_fixed_point( { width => 100, use_exif_thumbnail => 1 } );
+    my @out = $im->resize_multi($sizes);
+
+    is_deeply(
+        [ map { $_->as_jpeg() } @out ],
+        [ map { $_->as_jpeg() } _multi( 'jpg', 'cmyk.jpg', $sizes ) ],
+        'resize_multi after use_exif_thumbnail ok'
+    );
+}
+
+# Nor does snap
+{
+    my $sizes = [ { width => 80 } ];
+
+    my $im = Image::Scale->new( _f('jpg', 'rgb.jpg') );
+    $im->resize_gd_fixed_point( { width => 78, snap => 2 } );
+    my @out = $im->resize_multi($sizes);
+
+    ok( $out[0]->as_jpeg() eq ( _multi( 'jpg', 'rgb.jpg', $sizes ) )[0]->as_jpeg(), 'resize_multi after snap ok' );
+}
+
+# Errors
+{
+    my $im = Image::Scale->new( _f('png', 'rgb.png') );
+
+    eval { $im->resize_multi( [] ) };
+    like( $@, qr/requires at least one size/, 'resize_multi with no sizes dies ok' );
+
+    eval { $im->resize_multi( [ { width => 10, method => 'resize_foo' } ] ) };
+    like( $@, qr/unknown method resize_foo/, 'resize_multi unknown method dies ok' );
+
+    eval { $im->resize_multi( [ { width => 1000 }, { width => 10, memory_limit => 1000 } ] ) };
+    like( $@, qr/memory_limit exceeded/, 'resize_multi memory_limit ok' );
+}
+
+sub _resize {
+    my ( $dir, $file, $opts ) = @_;
+
+    my %opts = %{$opts};
+    my $resize = delete $opts{method} || 'resize';
+
+    my $im = Image::Scale->new( _f($dir, $file) );
+    $im->$resize( \%opts );
+
+    return $im;
+}
+
+sub _multi {
+    my ( $dir, $file, $sizes ) = @_;
+
+    return Image::Scale->new( _f($dir, $file) )->resize_multi($sizes);
+}
+
+sub _f {
+    return catfile( $FindBin::Bin, 'images', @_ );
+}
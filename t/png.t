@@ -13,7 +13,7 @@ use Image::Scale;
 my $png_version = Image::Scale->png_version();
 
 if ($png_version) {
-    plan tests => 46;
+    plan tests => 69;
 }
 else {
     plan skip_all => 'Image::Scale not built with libpng support';
@@ -65,6 +65,82 @@ for my $resize ( @resizes ) {
     }
 }
 
+# Small targets only decode the first Adam7 passes of interlaced images,
+# every 8th, 4th or 2nd pixel
+for my $test ( [ 'rgba_interlaced', 20 ], [ 'rgba_interlaced', 40 ], [ 'gray_interlaced', 80 ] ) {
+    my ( $type, $width ) = @{$test};
+
+    my $im = Image::Scale->new( _f("${type}.png") );
+    $im->resize_gd_fixed_point( { width => $width } );
+    my $data = $im->as_png();
+
+    is( _compare( \$data, "${type}_resize_gd_fixed_point_w${width}.png" ), 1, "PNG $type reduced decode $width ok" );
+}
+
+# A larger resize after a reduced one decodes all passes again
+{
+    my $im = Image::Scale->new( _f("rgba_interlaced.png") );
+    $im->resize_gd_fixed_point( { width => 20 } );
+    $im->resize_gd_fixed_point( { width => 100 } );
+    my $data = $im->as_png();
+
+    is( _compare( \$data, "rgba_interlaced_resize_gd_fixed_point_w100.png" ), 1, "PNG rgba_interlaced resize after reduced decode ok" );
+}
+
+# An alpha channel that is never used is dropped, the output is the same as from RGB
+{
+    my $im = Image::Scale->new( _f("rgba_opaque.png") );
+    $im->resize_gd_fixed_point( { width => 100 } );
+    my $data = $im->as_png();
+
+    is( _compare( \$data, "rgb_resize_gd_fixed_point_w100.png" ), 1, "PNG opaque RGBA written as RGB ok" );
+
+    my $saved;
+    $im->resize_gd_fixed_point( { width => 100, save_png => \$saved } );
+    ok( $saved eq $data, "PNG opaque RGBA save_png ok" );
+
+    # Transparent pixels keep it
+    $im = Image::Scale->new( _f("rgba.png") );
+    $im->resize_gd_fixed_point( { width => 100 } );
+    is( _color_type( $im->as_png() ), 6, "PNG transparent RGBA written as RGBA ok" );
+
+    # As does keep_aspect padding without a bgcolor
+    $im = Image::Scale->new( _f("rgb.png") );
+    $im->resize_gd_fixed_point( { width => 100, height => 100, keep_aspect => 1 } );
+    is( _color_type( $im->as_png() ), 6, "PNG keep_aspect padding written as RGBA ok" );
+}
+
+# Grayscale is written as RGB if the bgcolor isn't gray
+{
+    my $im = Image::Scale->new( _f("gray.png") );
+    $im->resize_gd_fixed_point( { width => 100, height => 100, keep_aspect => 1, bgcolor => 0x336699 } );
+    is( _color_type( $im->as_png() ), 2, "PNG gray with color bgcolor written as RGB ok" );
+}
+
+# Compression options change the file but not the pixels
+{
+    my $im = Image::Scale->new( _f("rgba.png") );
+    $im->resize_gd_fixed_point( { width => 100 } );
+    my $default = $im->as_png();
+    my $fast = $im->as_png( { fast => 1 } );
+
+    ok( $fast ne $default, "PNG fast as_png differs ok" );
+    is( _roundtrip($fast), _roundtrip($default), "PNG fast as_png pixels ok" );
+
+    my $outfile = _tmp("fast.png");
+    $im->save_png( $outfile, { fast => 1 } );
+    ok( ${ _load($outfile) } eq $fast, "PNG fast save_png ok" );
+
+    my $opts = { compression_level => 0, filter => 'none', strategy => 'huffman' };
+    is( _roundtrip( $im->as_png($opts) ), _roundtrip($default), "PNG uncompressed as_png pixels ok" );
+
+    eval { $im->as_png( { filter => 'bogus' } ) };
+    like( $@, qr/unknown PNG filter bogus/, "PNG unknown filter dies ok" );
+
+    eval { $im->as_png( { compression_level => 10 } ) };
+    like( $@, qr/compression_level must be 0-9/, "PNG bad compression_level dies ok" );
+}
+
 # XXX palette_bkgd
 
 # corrupt files from PNG test suite
@@ -150,6 +226,20 @@ for my $resize ( @resizes ) {
     is( _compare( _load($outfile), "apic_gd_fixed_point_w50.png" ), 1, "PNG resize_gd_fixed_point from offset ID3 tag ok" );
 }
 
+# offset image in MP3 ID3v2 tag in a scalar, read in place from the scalar
+{
+    my $im = Image::Scale->new(
+        _load( _f('v2.4-apic-png-350-58618.mp3') ),
+        { offset => 350, length => 58618 }
+    );
+
+    $im->resize_gd_fixed_point( { width => 50 } );
+    is( _compare( \$im->as_png(), "apic_gd_fixed_point_w50.png" ), 1, "PNG resize_gd_fixed_point from offset ID3 tag in scalar ok" );
+
+    $im->resize_gd_fixed_point( { width => 50 } );
+    is( _compare( \$im->as_png(), "apic_gd_fixed_point_w50.png" ), 1, "PNG resize again from offset ID3 tag in scalar ok" );
+}
+
 # 1-height image that would previously try to resize to 0-height
 {
     my $dataref = _load( _f("height1.png") );
@@ -162,6 +252,46 @@ for my $resize ( @resizes ) {
     is( _compare( _load($outfile), "height1_resize_gd_fixed_point_w100.png" ), 1, "PNG 1-height resize ok" );
 }
 
+# Fixed-point GM with filters other than Triangle
+for my $test ( [ rgb => 'Lanczos' ], [ rgba => 'Mitchell' ] ) {
+    my ( $type, $filter ) = @{$test};
+    my $outfile = _tmp("${type}_resize_gm_fixed_point_${filter}_w100.png");
+
+    my $im = Image::Scale->new( _f("${type}.png") );
+    $im->resize_gm_fixed_point( { width => 100, filter => $filter } );
+    $im->save_png($outfile);
+
+    is( _compare( _load($outfile), "${type}_resize_gm_fixed_point_${filter}_w100.png" ), 1, "PNG $type resize_gm_fixed_point $filter ok" );
+}
+
+# The gd resizers only keep a few source rows in memory, so memory_limit can be
+# lower than the size of the decoded image
+for my $resize ( qw(resize_gd resize_gd_fixed_point) ) {
+    my $im = Image::Scale->new( _f("rgb.png") );
+    $im->$resize( { width => 20, memory_limit => 40_000 } );
+
+    my $expected = Image::Scale->new( _f("rgb.png") );
+    $expected->$resize( { width => 20 } );
+
+    ok( $im->as_png() eq $expected->as_png(), "PNG $resize streamed within memory_limit ok" );
+}
+
+{
+    my $im = Image::Scale->new( _f("rgb.png") );
+    eval { $im->resize_gm( { width => 20, memory_limit => 40_000 } ) };
+    like( $@, qr/memory_limit exceeded/, 'PNG resize_gm memory_limit ok' );
+}
+
+# mmap option gives the same result
+{
+    my $im = Image::Scale->new( _f('rgba.png') );
+    $im->resize_gd_fixed_point( { width => 100 } );
+
+    my $mapped = Image::Scale->new( _f('rgba.png'), { mmap => 1 } );
+    $mapped->resize_gd_fixed_point( { width => 100 } );
+    ok( $mapped->as_png() eq $im->as_png(), 'PNG with mmap ok' );
+}
+
 diag("libpng version: $png_version");
 
 END {
@@ -187,6 +317,20 @@ sub _load {
     return \$data;
 }
 
+# Same-size resize of an encoded PNG, to compare pixels regardless of compression
+sub _roundtrip {
+    my $data = shift;
+
+    my $im = Image::Scale->new( \$data );
+    $im->resize_gd_fixed_point( { width => $im->width } );
+
+    return $im->as_png();
+}
+
+sub _color_type {
+    return ord( substr( $_[0], 25, 1 ) );
+}
+
 sub _compare {
     my ( $test, $path ) = @_;
 
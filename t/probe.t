@@ -0,0 +1,77 @@
+use strict;
+
+use File::Spec::Functions;
+use FindBin ();
+use Test::More tests => 19;
+
+use Image::Scale;
+
+# probe does not need the image libraries, so these run in every build
+my @tests = (
+    [ 'jpg/rgb.jpg',           { type => 'jpeg', width => 313, height => 234, channels => 3, orientation => 1 } ],
+    [ 'jpg/gray.jpg',          { type => 'jpeg', width => 313, height => 234, channels => 1, orientation => 1 } ],
+    [ 'jpg/cmyk.jpg',          { type => 'jpeg', width => 313, height => 234, channels => 4, orientation => 1 } ],
+    [ 'jpg/rgb_progressive.jpg', { type => 'jpeg', width => 313, height => 234, channels => 3, orientation => 1 } ],
+    [ 'jpg/exif_90_ccw.jpg',   { type => 'jpeg', width => 117, height => 157, channels => 3, orientation => 6 } ],
+    [ 'jpg/exif_mirror_vert.jpg', { type => 'jpeg', width => 157, height => 117, channels => 3, orientation => 4 } ],
+    [ 'jpg/large-exif.jpg',    { type => 'jpeg', width => 200, height => 200, channels => 3, orientation => 1 } ],
+    [ 'png/rgba.png',          { type => 'png', width => 160, height => 120, channels => 4, orientation => 1 } ],
+    [ 'png/gray_alpha.png',    { type => 'png', width => 160, height => 120, channels => 2, orientation => 1 } ],
+    [ 'png/palette.png',       { type => 'png', width => 160, height => 120, channels => 3, orientation => 1 } ],
+    [ 'gif/white.gif',         { type => 'gif', width => 160, height => 120, channels => 3, orientation => 1 } ],
+    [ 'bmp/24bit.bmp',         { type => 'bmp', width => 127, height => 64, channels => 3, orientation => 1 } ],
+    [ 'bmp/8bit_os2.bmp',      { type => 'bmp', width => 127, height => 64, channels => 3, orientation => 1 } ],
+);
+
+for my $test ( @tests ) {
+    my ( $file, $expected ) = @{$test};
+    is_deeply( Image::Scale->probe( _f($file) ), $expected, "probe $file ok" );
+}
+
+# From a scalar and with an offset
+{
+    my $data = ${ _load( _f('png/rgba.png') ) };
+    is_deeply( Image::Scale->probe( \$data ), $tests[7]->[1], 'probe from scalar ok' );
+
+    is_deeply(
+        Image::Scale->probe( _f('jpg/v2.4-apic-jpg-351-2103.mp3'), { offset => 351, length => 2103 } ),
+        { type => 'jpeg', width => 192, height => 256, channels => 3, orientation => 1 },
+        'probe from offset ID3 tag ok'
+    );
+
+    my $mp3 = ${ _load( _f('png/v2.4-apic-png-350-58618.mp3') ) };
+    is( Image::Scale->probe( \$mp3, { offset => 350, length => 58618 } )->{width}, 320, 'probe from offset ID3 tag in scalar ok' );
+}
+
+# Not images
+{
+    my $junk = 'not an image';
+    ok( !defined Image::Scale->probe( \$junk ), 'probe of non-image returns undef ok' );
+    ok( !defined Image::Scale->probe( _f('png/x00n0g01.png') ), 'probe of 0x0 PNG returns undef ok' );
+}
+
+# probe_many keeps the order, with undef for files that can't be probed
+{
+    my $info = Image::Scale->probe_many( [ _f('jpg/rgb.jpg'), _f('missing.jpg'), _f('gif/white.gif') ] );
+
+    is_deeply(
+        [ map { $_ ? $_->{type} : undef } @{$info} ],
+        [ 'jpeg', undef, 'gif' ],
+        'probe_many ok'
+    );
+}
+
+sub _f {
+    return catfile( $FindBin::Bin, 'images', @_ );
+}
+
+sub _load {
+    my $path = shift;
+
+    open my $fh, '<', $path or die "Cannot open $path";
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    return \$data;
+}
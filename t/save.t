@@ -0,0 +1,175 @@
+use strict;
+
+use File::Path ();
+use File::Spec::Functions;
+use FindBin ();
+use Test::More;
+
+use Image::Scale;
+
+# Saving as part of the resize must give the same file as saving afterwards
+my @resizes = qw(
+    resize_gd
+    resize_gd_fixed_point
+    resize_gm
+);
+
+my @tests = (
+    [ 'png', 'rgba.png', { width => 100 } ],
+    [ 'png', 'rgb.png', { width => 50, height => 50, keep_aspect => 1, bgcolor => 0x336699 } ],
+    [ 'png', 'gray_alpha.png', { width => 40, height => 60, keep_aspect => 1, threads => 3 } ],
+    [ 'jpg', 'exif_mirror_horiz.jpg', { width => 37 } ],
+    [ 'jpg', 'exif_90_ccw.jpg', { width => 37, height => 61 } ],
+);
+
+if ( Image::Scale->png_version() && Image::Scale->jpeg_version() ) {
+    plan tests => scalar(@resizes) * scalar(@tests) * 2 + 13;
+}
+else {
+    plan skip_all => 'Image::Scale not built with libjpeg and libpng support';
+}
+
+my $tmpdir = catdir( $FindBin::Bin, 'tmp_save' );
+if ( -d $tmpdir ) {
+    File::Path::rmtree($tmpdir);
+}
+mkdir $tmpdir;
+
+for my $test ( @tests ) {
+    my ( $dir, $file, $opts ) = @{$test};
+
+    for my $resize ( @resizes ) {
+        my $im = Image::Scale->new( _f($dir, $file) );
+        $im->$resize($opts);
+        my $png  = $im->as_png();
+        my $jpeg = $im->as_jpeg(80);
+
+        my $data;
+        $im = Image::Scale->new( _f($dir, $file) );
+        $im->$resize( { %{$opts}, save_png => \$data } );
+        ok( $data eq $png, "$file $resize save_png to scalar ok" );
+
+        my $outfile = catfile( $tmpdir, "${file}_${resize}.jpg" );
+        $im = Image::Scale->new( _f($dir, $file) );
+        $im->$resize( { %{$opts}, save_jpeg => $outfile, quality => 80 } );
+        ok( ${ _load($outfile) } eq $jpeg, "$file $resize save_jpeg to file ok" );
+    }
+}
+
+# The resized image is not kept
+{
+    my $data;
+    my $im = Image::Scale->new( _f('png', 'rgb.png') );
+    $im->resize( { width => 50, save_png => \$data } );
+
+    is( $im->resized_width(), 50, 'save_png resized_width ok' );
+    eval { $im->as_png() };
+    like( $@, qr/no output data/, 'save_png does not keep the resized image ok' );
+
+    # And the object can be resized again
+    $im->resize( { width => 20 } );
+    is( $im->resized_width(), 20, 'resize after save_png ok' );
+}
+
+# resize_multi
+{
+    my ( $large, $small );
+    my $im = Image::Scale->new( _f('png', 'rgba.png') );
+    my @out = $im->resize_multi( [ { width => 100, save_png => \$large }, { width => 20, save_png => \$small } ] );
+
+    my $expected = Image::Scale->new( _f('png', 'rgba.png') );
+    $expected->resize( { width => 100 } );
+
+    ok( $large eq $expected->as_png(), 'resize_multi save_png ok' );
+    ok( length($small) > 0, 'resize_multi save_png from earlier size ok' );
+}
+
+# PNG compression options are the same as when saving afterwards
+{
+    my $png;
+    my $im = Image::Scale->new( _f('png', 'rgb.png') );
+    $im->resize_multi( [ { width => 50, save_png => \$png, png_options => { fast => 1 } } ] );
+
+    my $expected = Image::Scale->new( _f('png', 'rgb.png') );
+    $expected->resize( { width => 50 } );
+    ok( $png eq $expected->as_png( { fast => 1 } ), 'save_png with png_options ok' );
+}
+
+{
+    my $im = Image::Scale->new( _f('png', 'rgb.png') );
+    eval { $im->resize( { width => 50, save_png => catfile( $tmpdir, 'missing', 'x.png' ) } ) };
+    like( $@, qr/cannot open/, 'save_png to bad path dies ok' );
+}
+
+# A resize that fails leaves an existing file alone
+{
+    my $outfile = catfile( $tmpdir, 'existing.jpg' );
+    open my $fh, '>', $outfile or die "Cannot write $outfile";
+    print $fh 'existing';
+    close $fh;
+
+    my $im = Image::Scale->new( _f('jpg', 'exif_90_ccw.jpg') );
+    eval { $im->resize( { width => 37, memory_limit => 1000, save_jpeg => $outfile } ) };
+    like( $@, qr/memory_limit exceeded/, 'save_jpeg with failed resize dies ok' );
+
+    undef $im;
+    is( ${ _load($outfile) }, 'existing', 'save_jpeg with failed resize keeps existing file ok' );
+    ok( !_leftovers($outfile), 'save_jpeg with failed resize removes temporary file ok' );
+}
+
+# The temporary file never replaces another file, and the result gets the usual permissions
+{
+    my $outfile = catfile( $tmpdir, 'perms.jpg' );
+    open my $fh, '>', "$outfile.tmp" or die "Cannot write $outfile.tmp";
+    print $fh 'mine';
+    close $fh;
+
+    my $im = Image::Scale->new( _f('jpg', 'exif_90_ccw.jpg') );
+    $im->resize( { width => 37, save_jpeg => $outfile } );
+
+    is( ${ _load("$outfile.tmp") }, 'mine', 'save_jpeg leaves an existing PATH.tmp alone ok' );
+    is( ( stat $outfile )[2] & 07777, 0666 & ~umask, 'save_jpeg file permissions follow the umask ok' );
+}
+
+# A resize_multi that can't decode the source removes its temporary files
+{
+    my $data = ${ _load( _f('png', 'rgb.png') ) };
+    $data = substr( $data, 0, length($data) / 2 );
+
+    my $im = Image::Scale->new( \$data );
+
+    open OLD_STDERR, '>&', STDERR;
+    close STDERR;
+    $im->resize_multi( [
+        { width => 20, save_jpeg => catfile( $tmpdir, 'multi_failed_20.jpg' ) },
+        { width => 10, save_jpeg => catfile( $tmpdir, 'multi_failed_10.jpg' ) },
+    ] );
+    open STDERR, '>&', OLD_STDERR;
+
+    is( scalar( glob( catfile( $tmpdir, 'multi_failed*' ) ) ), undef, 'resize_multi with failed decode removes temporary files ok' );
+}
+
+END {
+    File::Path::rmtree($tmpdir);
+}
+
+sub _f {
+    return catfile( $FindBin::Bin, 'images', @_ );
+}
+
+sub _leftovers {
+    my $path = shift;
+
+    return grep { /^\Q$path\E\.\w{6}$/ } glob( catfile( $tmpdir, '*' ) );
+}
+
+sub _load {
+    my $path = shift;
+
+    open my $fh, '<', $path or die "Cannot open $path";
+    binmode $fh;
+    my $data = do { local $/; <$fh> };
+    close $fh;
+
+    return \$data;
+}
@@ -0,0 +1,118 @@
+use strict;
+
+use File::Spec::Functions;
+use FindBin ();
+use Compress::Zlib ();
+use Test::More;
+
+use Image::Scale;
+
+if ( Image::Scale->png_version() ) {
+    plan tests => 74;
+}
+else {
+    plan skip_all => 'Image::Scale not built with libpng support';
+}
+
+# Every kernel set must produce exactly the same output from the fixed-point resizes
+my @resizes = (
+    [ 'resize_gd_fixed_point' ],
+    [ 'resize_gm_fixed_point', 'Triangle' ],
+    [ 'resize_gm_fixed_point', 'Lanczos' ],
+);
+
+like( Image::Scale->simd, qr/^(generic|sse41|avx2)$/, 'simd kernel name ok' );
+
+eval { Image::Scale->simd('foo') };
+like( $@, qr/unknown SIMD kernel set/, 'simd unknown name croaks ok' );
+
+my %expected;
+Image::Scale->simd('generic');
+for my $type ( qw(rgb rgba) ) {
+    for my $resize ( @resizes ) {
+        $expected{$type}->{ join '_', @{$resize} } = _resize( $type, @{$resize} );
+    }
+}
+
+for my $name ( qw(sse41 avx2) ) {
+    my $warning;
+    local $SIG{__WARN__} = sub { $warning = shift };
+
+    my $using = Image::Scale->simd($name);
+
+    SKIP: {
+        skip "$name kernels not supported by this CPU ($using)", 6 if $warning;
+
+        for my $type ( qw(rgb rgba) ) {
+            for my $resize ( @resizes ) {
+                my $key = join '_', @{$resize};
+                ok( _resize( $type, @{$resize} ) eq $expected{$type}->{$key}, "$name $type $key ok" );
+            }
+        }
+    }
+}
+
+# The floating-point resize_gm rounds a little differently with each set (FMA for one),
+# but every filter must stay within 1 level of the generic kernels
+my @filters = qw(
+    Point Box Triangle Hermite Hanning Hamming Blackman Gaussian
+    Quadratic Cubic Catrom Mitchell Lanczos Bessel Sinc
+);
+
+my %expected_gm;
+Image::Scale->simd('generic');
+for my $type ( qw(rgb rgba) ) {
+    for my $filter ( @filters ) {
+        $expected_gm{$type}->{$filter} = _pixels( _resize( $type, 'resize_gm', $filter, 'none' ) );
+    }
+}
+
+for my $name ( qw(sse41 avx2) ) {
+    my $warning;
+    local $SIG{__WARN__} = sub { $warning = shift };
+
+    my $using = Image::Scale->simd($name);
+
+    SKIP: {
+        skip "$name kernels not supported by this CPU ($using)", 30 if $warning;
+
+        for my $type ( qw(rgb rgba) ) {
+            for my $filter ( @filters ) {
+                my $pixels   = _pixels( _resize( $type, 'resize_gm', $filter, 'none' ) );
+                my $expected = $expected_gm{$type}->{$filter};
+                my $max      = length($pixels) == length($expected) ? 0 : 256;
+
+                for my $i ( 0 .. length($expected) - 1 ) {
+                    my $diff = abs( ord( substr( $pixels, $i, 1 ) ) - ord( substr( $expected, $i, 1 ) ) );
+                    $max = $diff if $diff > $max;
+                }
+
+                cmp_ok( $max, '<=', 1, "$name $type resize_gm $filter within 1 level ok" );
+            }
+        }
+    }
+}
+
+sub _resize {
+    my ( $type, $resize, $filter, $png_filter ) = @_;
+
+    my $im = Image::Scale->new( catfile( $FindBin::Bin, 'images', 'png', "${type}.png" ) );
+    $im->$resize( { width => 100, $filter ? ( filter => $filter ) : () } );
+
+    return $im->as_png( $png_filter ? { filter => $png_filter } : () );
+}
+
+# The raw pixels of a PNG written without row filters, each row still starts with a 0 byte
+sub _pixels {
+    my $png  = shift;
+    my $idat = '';
+    my $pos  = 8;
+
+    while ( $pos < length($png) ) {
+        my ( $len, $chunk ) = unpack 'Na4', substr( $png, $pos, 8 );
+        $idat .= substr( $png, $pos + 8, $len ) if $chunk eq 'IDAT';
+        $pos += $len + 12;
+    }
+
+    return Compress::Zlib::uncompress($idat);
+}
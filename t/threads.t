@@ -0,0 +1,52 @@
+use strict;
+
+use File::Spec::Functions;
+use FindBin ();
+use Test::More;
+
+use Image::Scale;
+
+# Output must not depend on the number of threads used
+my @resizes = qw(
+    resize_gd
+    resize_gd_fixed_point
+    resize_gm
+    resize_gm_fixed_point
+);
+
+my @tests = (
+    [ 'png', 'rgba.png', { width => 100 } ],
+    [ 'png', 'rgb.png', { width => 50, height => 50, keep_aspect => 1 } ],
+    [ 'jpg', 'exif_90_ccw.jpg', { width => 37, height => 61 } ],
+);
+
+if ( Image::Scale->png_version() && Image::Scale->jpeg_version() ) {
+    plan tests => scalar(@resizes) * scalar(@tests) * 2;
+}
+else {
+    plan skip_all => 'Image::Scale not built with libjpeg and libpng support';
+}
+
+for my $test ( @tests ) {
+    my ( $dir, $file, $opts ) = @{$test};
+
+    for my $resize ( @resizes ) {
+        my $expected = _resize( $dir, $file, $resize, $opts );
+
+        for my $threads ( 3, 8 ) {
+            ok(
+                _resize( $dir, $file, $resize, { %{$opts}, threads => $threads } ) eq $expected,
+                "$file $resize threads $threads ok"
+            );
+        }
+    }
+}
+
+sub _resize {
+    my ( $dir, $file, $resize, $opts ) = @_;
+
+    my $im = Image::Scale->new( catfile( $FindBin::Bin, 'images', $dir, $file ) );
+    $im->$resize($opts);
+
+    return $im->as_png();
+}
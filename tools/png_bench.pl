@@ -0,0 +1,61 @@
+#!/usr/bin/perl
+
+# Compares the size and speed of the PNG encoder settings, for example:
+#   perl -Mblib tools/png_bench.pl t/images/png 200
+
+use strict;
+
+use File::Spec::Functions;
+use Image::Scale;
+use Time::HiRes qw(time);
+
+my $dir   = shift || die "Directory of PNG files required\n";
+my $width = shift || 0;
+my $iters = shift || 20;
+
+my @profiles = (
+    [ default     => {} ],
+    [ level_1     => { compression_level => 1 } ],
+    [ level_9     => { compression_level => 9 } ],
+    [ filter_none => { filter => 'none' } ],
+    [ filter_sub  => { filter => 'sub' } ],
+    [ filter_up   => { filter => 'up' } ],
+    [ filter_all  => { filter => 'all' } ],
+    [ huffman     => { strategy => 'huffman' } ],
+    [ rle         => { strategy => 'rle' } ],
+    [ rle_up      => { strategy => 'rle', filter => 'up' } ],
+    [ level_1_sub => { compression_level => 1, filter => 'sub' } ],
+    [ fast        => { fast => 1 } ],
+);
+
+opendir my $dh, $dir or die "Cannot open $dir\n";
+my @files = sort grep { /\.png$/i } readdir $dh;
+closedir $dh;
+
+# Resize once, only the encoding is timed
+my @images;
+for my $file (@files) {
+    my $img = eval { Image::Scale->new( catfile( $dir, $file ) ) } or next;
+    eval { $img->resize_gd_fixed_point( { width => $width || $img->width } ); 1 } or next;
+    push @images, $img;
+}
+
+warn "Encoding " . scalar(@images) . " images $iters times...\n";
+
+printf "%-12s %10s %8s %10s\n", 'profile', 'bytes', 'size', 'ms';
+
+my $base;
+for my $profile (@profiles) {
+    my ( $name, $opts ) = @{$profile};
+    my $bytes = 0;
+
+    my $start = time();
+    for ( 1 .. $iters ) {
+        $bytes = 0;
+        $bytes += length( $_->as_png($opts) ) for @images;
+    }
+    my $ms = ( time() - $start ) * 1000 / $iters;
+
+    $base ||= $bytes;
+    printf "%-12s %10d %7.1f%% %10.2f\n", $name, $bytes, $bytes * 100 / $base, $ms;
+}